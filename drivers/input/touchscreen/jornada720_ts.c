@@ -22,16 +22,38 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/bitops.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
 
 #include <mach/hardware.h>
 #include <mach/jornada720.h>
 #include <mach/irqs.h>
 
-//Timer Variable for detecting pen-up
-#define TIMEOUT 50    //milliseconds
+#include "jornada720_ts.h"
+
+//Timer Variable for detecting pen-up, only a fallback in case an edge on GPIO9 got lost
+#define TIMEOUT 200    //milliseconds
 static struct timer_list pen_timer;
 static unsigned int count = 0;
 
+// Pen-up debounce: GPIO9 is pulsed high for every new MCU sample, only
+// a level that stays high for pen_debounce usec is a real lift.
+static struct hrtimer debounce_timer;
+static struct platform_device *ts_pdev;
+#define PEN_RELEASE 0	// bit in pen_flags: the IRQ thread should check for pen-up
+#define PEN_FALLBACK 1	// bit in pen_flags: the release was requested by the fallback timer
+#define PEN_SAMPLE 2	// bit in pen_flags: a falling edge announced a new sample
+static unsigned long pen_flags;
+
 MODULE_AUTHOR("Timo Biesenbach<timo.biesenbach@gmail.com>");
 MODULE_DESCRIPTION("HP Jornada 710/720/728 touchscreen driver, improved, based on work by K.Ericson");
 MODULE_LICENSE("GPL v2");
@@ -67,18 +89,71 @@ static int my = 1024;
 module_param(my, int, 0444);
 MODULE_PARM_DESC(my, "calibration: y-gradient  in 1/1024.");
 
+static int matrix[7];
+static int matrix_count = 0;
+module_param_array(matrix, int, &matrix_count, 0444);
+MODULE_PARM_DESC(matrix, "calibration: affine matrix a0..a6 in tslib pointercal order, x=(a2+a0*X+a1*Y)/a6, y=(a5+a3*X+a4*Y)/a6. Overrides mx/dx/my/dy.");
+
+static int median = 1;
+module_param(median, int, 0444);
+MODULE_PARM_DESC(median, "filter: 1: use the median of the 3 raw MCU samples (default), 0: average them.");
+
 static int filter = 0;
 module_param(filter, int, 0444);
 MODULE_PARM_DESC(filter, "filter: specifies smoothing over the n last coordinates. 0 to disable, max. 100.");
 
+static int iir = 0;
+module_param(iir, int, 0444);
+MODULE_PARM_DESC(iir, "filter: exponential smoothing, new = old + (sample - old) / 2^iir. 0 to disable, max. 6.");
+
+static int euro = 0;
+module_param(euro, int, 0444);
+MODULE_PARM_DESC(euro, "filter: 1: speed adaptive 1-euro filter, smooth at rest and little lag when moving.");
+
+static int euro_mincutoff = 100;
+module_param(euro_mincutoff, int, 0444);
+MODULE_PARM_DESC(euro_mincutoff, "filter: 1-euro cutoff frequency at rest in 1/100 Hz (default 100 = 1Hz). Lower is smoother.");
+
+static int euro_beta = 10;
+module_param(euro_beta, int, 0444);
+MODULE_PARM_DESC(euro_beta, "filter: 1-euro cutoff increase with speed in 1/1000 Hz per pixel/s (default 10). Higher is less lag.");
+
 static int relative = 0;
 module_param(relative, int, 0444);
 MODULE_PARM_DESC(relative, "relative: 1:switch to reporting relative movement (like a mouse), 0: absolute movement (default).");
 
-static int x_invert = 0;    // in case of negative calibration data
-static int y_invert = 0;
+static int rel_gain = 256;
+module_param(rel_gain, int, 0444);
+MODULE_PARM_DESC(rel_gain, "relative: pointer movement per pen movement in 1/256 (default 256 = follow the pen).");
+
+static int rel_accel = 0;
+module_param(rel_accel, int, 0444);
+MODULE_PARM_DESC(rel_accel, "relative: gain increase in 1/256 per pixel the pen moved since the last report (default 0 = no acceleration).");
+
+static int predict = 0;
+module_param(predict, int, 0444);
+MODULE_PARM_DESC(predict, "filter: extrapolate the position this many msec ahead from pen speed, 0 to disable, max. 50.");
+
+static int max_rate = 0;
+module_param(max_rate, int, 0444);
+MODULE_PARM_DESC(max_rate, "reporting: maximum position updates per second, 0 for every MCU sample (default).");
 
-static int calibrated = 0;  // Signals that calibration data is loaded.
+static int deadband = 0;
+module_param(deadband, int, 0444);
+MODULE_PARM_DESC(deadband, "reporting: movement in pixels (after filtering) below which no position update is sent. 0 to disable.");
+
+static int pen_debounce = 2000;
+module_param(pen_debounce, int, 0444);
+MODULE_PARM_DESC(pen_debounce, "pen-up: time in usec GPIO9 has to stay high to count as pen lifted (default 2000, 100-20000).");
+
+// Calibration matrix, tslib pointercal layout. NULL: report raw coordinates.
+// Read under RCU from the IRQ thread, replaced as a whole through sysfs.
+struct jornada_ts_cal {
+	int a[7];
+	struct rcu_head rcu;
+};
+static struct jornada_ts_cal __rcu *ts_cal;
+static DEFINE_MUTEX(ts_cal_mutex);
 
 static int rmb_sent = 0;    // we send a RMB event (need to close it on next gesture)
 static int mmb_sent = 0;    // we send a RMB event (need to close it on next gesture)
@@ -86,179 +161,363 @@ static int lmb_sent = 0;    // we send a LMB event (need to close it on next ges
 static int touch_sent = 0;    // we send a TOUCH event (need to close it on next gesture)
 static int lmb_locked = 0;    // left mouse button is locked (media icon toggles) --> do not send a release.
 
-// rolling average for smoothing coords
-#define XY_HISTORY 100
-static int hist_x[XY_HISTORY];
-static int hist_y[XY_HISTORY];
-static int hist_count = 0; // number of samples in history
-static int hist_ptr = 0;   // curent sample 
+// Filter chain, tunables are copied from the module parameters at probe time
+static struct jornada_ts_params ts_params;
+static struct jornada_ts_filter ts_filter;
+static ktime_t filter_last;		// timestamp of the previous sample
+static int filter_last_valid;
 
 // relative movement support
-#define MAXX 640    // maximum screen size
-#define MAXY 240
+#define REL_SHIFT 8			// gain and remainders are in 1/256
+#define REL_MAX_GAIN (16 << REL_SHIFT)
 static int old_x = -1;	//previous pointer position
 static int old_y = -1;
+static int rem_x = 0;	// sub-pixel movement not reported yet
+static int rem_y = 0;
 
 static int pendown = 0; // track if pen is touched or lifted
 
+// last reported position, for rate limiting and the dead-band
+static int report_valid = 0;	// a position was reported since pen-down
+static int report_x, report_y;
+static ktime_t report_time;
+static int pending = 0;			// a suppressed position is waiting, send it on pen-up
+static int pending_x, pending_y;
+
+// Sampling statistics, exposed in /sys/bus/platform/devices/jornada_ts/statistics
+#define STATS_BUCKETS 16	// log2 histogram buckets: 0us, 1us, 2-3us, 4-7us, ... >=16ms
+
+struct jornada_ts_stats {
+	unsigned long irqs;				// hard IRQs, both edges
+	unsigned long threads;			// IRQ thread runs
+	unsigned long samples;			// SSP transactions
+	unsigned long ssp_errors;		// GETTOUCHSAMPLES not answered with TXDUMMY
+	unsigned long pendown_drops;	// first sample after pen-down, dropped
+	unsigned long softkey_samples;	// samples in the softkey area
+	unsigned long suppressed;		// position updates dropped by max_rate / deadband
+	unsigned long reports;			// position updates sent
+	unsigned long releases;			// pen-ups detected
+	unsigned long fallback_releases;	// pen-ups only noticed by the fallback timer
+	unsigned long ssp_timeouts;		// transactions aborted because the MCU did not answer
+	unsigned long kbd_waits;		// keyboard IRQ became pending while we held the SSP link
+
+	unsigned long thread_hist[STATS_BUCKETS];	// IRQ thread run time
+	unsigned long ssp_hist[STATS_BUCKETS];		// SSP lock held, interrupts off
+	u32 thread_max_us;
+	u32 ssp_max_us;
+
+	s64 pendown_ns;					// total time the pen was down
+	unsigned long pendown_samples;	// samples taken while the pen was down
+
+	u32 latency_last_us;			// pen-down edge to first position report
+	u32 latency_min_us;
+	u32 latency_max_us;
+	u64 latency_sum_us;
+	unsigned long latency_count;
+};
+static struct jornada_ts_stats ts_stats;
+static ktime_t touch_start;		// falling edge that started the current touch
+static int touch_start_valid;
+static ktime_t pendown_start;
+
+static void jornada720_ts_stats_hist(unsigned long *hist, u32 *max, s64 us)
+{
+	int bucket;
+
+	if (us < 0) us = 0;
+	if (us > *max) *max = (u32)us;
+	bucket = fls((u32)us);
+	if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+	hist[bucket]++;
+}
+
+// first position report of a touch: record the pen-down latency
+static void jornada720_ts_stats_latency(void)
+{
+	u32 us;
+
+	if (!touch_start_valid) return;
+	touch_start_valid = 0;
+
+	us = (u32)ktime_us_delta(ktime_get(), touch_start);
+	ts_stats.latency_last_us = us;
+	if (!ts_stats.latency_count || us < ts_stats.latency_min_us) ts_stats.latency_min_us = us;
+	if (us > ts_stats.latency_max_us) ts_stats.latency_max_us = us;
+	ts_stats.latency_sum_us += us;
+	ts_stats.latency_count++;
+}
+
 struct jornada_ts {
 	struct input_dev *dev;
+	u8 raw[8];			/* SSP bytes as received */
 	int x_data[4];		/* X sample values */
 	int y_data[4];		/* Y sample values */
 };
 
-static void jornada720_ts_collect_data(struct jornada_ts *jornada_ts)
+#ifdef CONFIG_DEBUG_FS
+// Raw sample capture through debugfs, active while the "raw" file is open
+#define CAPTURE_RECORDS 256
+static DEFINE_KFIFO(capture_fifo, struct jornada_ts_record, CAPTURE_RECORDS);
+static DECLARE_WAIT_QUEUE_HEAD(capture_wait);
+static struct dentry *capture_dir;
+static unsigned long capture_open;	// bit 0: reader present
+static int capture_lost;			// records dropped since the last one stored
+#endif
+
+/*
+ * The keyboard driver shares the MCU link. jornada_ssp_start() keeps
+ * interrupts off until jornada_ssp_end(), so a keypress arriving during a
+ * touch read waits for the whole transaction. Touch reads are therefore
+ * one bounded transaction, aborted on the first timeout, and keypresses
+ * that had to wait for one are counted.
+ */
+static void jornada720_ts_ssp_end(void)
 {
+	// edge on the keyboard IRQ line while our interrupts were off
+	if (GEDR & GPIO_GPIO(0)) ts_stats.kbd_waits++;
 
-    /* 3 low word X samples */
-    jornada_ts->x_data[0] = jornada_ssp_byte(TXDUMMY);
-    jornada_ts->x_data[1] = jornada_ssp_byte(TXDUMMY);
-    jornada_ts->x_data[2] = jornada_ssp_byte(TXDUMMY);
+	jornada_ssp_end();
+}
+
+// Read one touch sample. Returns 0 on success, -EIO for a bad reply, -ETIMEDOUT if the MCU stopped answering.
+static int jornada720_ts_collect_data(struct jornada_ts *jornada_ts)
+{
+    int i, ret;
+
+    /* proper reply to request is always TXDUMMY */
+    ret = jornada_ssp_inout(GETTOUCHSAMPLES);
+    if (ret < 0) return ret;
+    if (ret != TXDUMMY) return -EIO;
+
+    /* 3 low word X samples, 3 low word Y samples, combined x samples bits, combined y samples bits */
+    for (i=0; i<8; i++) {
+        ret = jornada_ssp_byte(TXDUMMY);
+        if (ret < 0) return ret;
+        jornada_ts->raw[i] = ret;
+    }
+
+    jornada720_ts_unpack(jornada_ts->raw, jornada_ts->x_data, jornada_ts->y_data);
+    return 0;
+}
+
+#ifdef CONFIG_DEBUG_FS
+// Store a capture record if somebody is reading them
+static void jornada720_ts_capture(const u8 *raw, u8 flags)
+{
+	struct jornada_ts_record rec;
 
-    /* 3 low word Y samples */
-    jornada_ts->y_data[0] = jornada_ssp_byte(TXDUMMY);
-    jornada_ts->y_data[1] = jornada_ssp_byte(TXDUMMY);
-    jornada_ts->y_data[2] = jornada_ssp_byte(TXDUMMY);
+	if (!test_bit(0, &capture_open)) return;
 
-    /* combined x samples bits */
-    jornada_ts->x_data[3] = jornada_ssp_byte(TXDUMMY);
+	memset(&rec, 0, sizeof(rec));
+	rec.time_ns = ktime_to_ns(ktime_get());
+	if (raw) memcpy(rec.data, raw, sizeof(rec.data));
+	rec.flags = flags;
+	if (capture_lost) rec.flags |= JORNADA_TS_REC_OVERFLOW;
 
-    /* combined y samples bits */
-    jornada_ts->y_data[3] = jornada_ssp_byte(TXDUMMY);
+	if (kfifo_put(&capture_fifo, rec)) {
+		capture_lost = 0;
+		wake_up_interruptible(&capture_wait);
+	} else {
+		capture_lost++;
+	}
 }
 
-static int jornada720_ts_average(int coords[4])
+static int jornada720_ts_capture_open(struct inode *inode, struct file *file)
 {
-	int coord;
-	int high_bits = coords[3];
+	// one reader at a time, it owns the fifo
+	if (test_and_set_bit(0, &capture_open))
+		return -EBUSY;
 
-	coord  = coords[0] | ((high_bits & 0x03) << 8);
-	coord += coords[1] | ((high_bits & 0x0c) << 6);
-	coord += coords[2] | ((high_bits & 0x30) << 4);
+	kfifo_reset_out(&capture_fifo);
+	capture_lost = 0;
+	return nonseekable_open(inode, file);
+}
 
-	return coord / 3;
+static int jornada720_ts_capture_release(struct inode *inode, struct file *file)
+{
+	clear_bit(0, &capture_open);
+	return 0;
 }
 
-// simplistic rolling average smoothing filter
-// will keep a history of up to XY_HISTORY samples in two arrays
-// - the current sample will be added at the hist_ptr++ location
-// - the number of samples will be tracked in hist_count
-// - hist_count and hist_ptr will be reset on pen lift
-// this fuction will return an average of the coord values in the list
-static void jornada720_ts_filter(int *px, int *py) {
-	int tx, ty, i;
-	tx = *px;
-	ty = *py;
+static ssize_t jornada720_ts_capture_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned int copied;
+	int error;
 
-	hist_count++;
-	if (hist_count>filter) hist_count=filter;
+	if (count < sizeof(struct jornada_ts_record))
+		return -EINVAL;
 
-	hist_x[hist_ptr] = tx;
-	hist_y[hist_ptr] = ty;
-	hist_ptr = (hist_ptr+1) % filter;
-	
-	tx = 0;
-	ty = 0;
-	for (i=0;i<hist_count;i++) {
-		tx += hist_x[i];
-		ty += hist_y[i];
+	if (kfifo_is_empty(&capture_fifo)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		error = wait_event_interruptible(capture_wait, !kfifo_is_empty(&capture_fifo));
+		if (error) return error;
 	}
 
-	tx = tx / hist_count;
-	ty = ty / hist_count;
-
-	*px = tx;
-	*py = ty;
+	error = kfifo_to_user(&capture_fifo, buf, count, &copied);
+	return error ? error : copied;
 }
 
-static void jornada720_ts_filter_reset(void) {
-	hist_count=0;
-	hist_ptr=0;
-}
+static const struct file_operations jornada720_ts_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jornada720_ts_capture_open,
+	.release	= jornada720_ts_capture_release,
+	.read		= jornada720_ts_capture_read,
+	.llseek		= no_llseek,
+};
 
-// Simplistic linear calibration function.
-static void jornada720_ts_calibrate(int *px, int *py) {
-	int tx, ty;
+static void jornada720_ts_capture_init(void)
+{
+	capture_dir = debugfs_create_dir("jornada720_ts", NULL);
+	if (IS_ERR_OR_NULL(capture_dir)) {
+		capture_dir = NULL;
+		return;
+	}
+	debugfs_create_file("raw", 0400, capture_dir, NULL, &jornada720_ts_capture_fops);
+}
 
-	tx = *px;
-	ty = *py;
+static void jornada720_ts_capture_exit(void)
+{
+	debugfs_remove_recursive(capture_dir);
+	capture_dir = NULL;
+}
+#else
+#define jornada720_ts_capture(raw, flags)
+#define jornada720_ts_capture_init()
+#define jornada720_ts_capture_exit()
+#endif /* CONFIG_DEBUG_FS */
 
-	tx = ((tx * mx) >> 10) + dx;
-	ty = ((ty * my) >> 10) + dy;
+static void jornada720_ts_filter(int *px, int *py) {
+	ktime_t now = ktime_get();
+	u32 dt_us = 0;
 
-	// Axis inversion again
-	if (x_invert) tx=640-tx;
-	if (y_invert) ty=240-ty;
+	if (filter_last_valid)
+		dt_us = (u32)ktime_us_delta(now, filter_last);
+	filter_last = now;
+	filter_last_valid = 1;
 
-	// Handle potential negative values
-	if (tx<0) tx=0;
-	if (ty<0) ty=0;
+	jornada720_ts_filter_apply(&ts_filter, &ts_params, px, py, dt_us);
+}
 
-	*px = tx;
-	*py = ty;
+static void jornada720_ts_filter_reset(void) {
+	jornada720_ts_filter_init(&ts_filter);
+	filter_last_valid = 0;
 }
 
 static void jornada720_ts_reset_relxy(void) {
 	old_x=-1;
 	old_y=-1;
+	rem_x=0;
+	rem_y=0;
+}
+
+// Scale one axis by gain (1/256) and carry the fractional part over to the next sample.
+static int jornada720_ts_rel_axis(int d, int gain, int *rem) {
+	int out;
+
+	*rem += d * gain;
+	out = *rem / (1 << REL_SHIFT);	// rounds towards zero, the rest stays in rem
+	*rem -= out * (1 << REL_SHIFT);
+
+	return out;
 }
 
 // Get dx/dy, save old x and y for next round.
+// gain = rel_gain + rel_accel * distance, so slow movements stay precise and fast strokes cover the screen.
 static void jornada720_ts_get_relxy(int *px, int *py) {
 	int dx = 0;
 	int dy = 0;
+	int gain;
 
-	if (old_x>0) dx = *px - old_x;
-	if (old_y>0) dy = *py - old_y;
+	if (old_x>=0 && old_y>=0) {
+		dx = *px - old_x;
+		dy = *py - old_y;
+	}
 
 	old_x = *px;
 	old_y = *py;
 
-	// Limit movement to -1 / +1
-	if (dx >  1) dx=1;
-	if (dx < -1) dx=-1;
-	if (dy >  1) dy=1;
-	if (dy < -1) dx=-1;
+	gain = rel_gain + rel_accel * (int)int_sqrt(dx*dx + dy*dy);
+	if (gain > REL_MAX_GAIN) gain = REL_MAX_GAIN;
 
-	*px = dx;
-	*py = dy;
+	*px = jornada720_ts_rel_axis(dx, gain, &rem_x);
+	*py = jornada720_ts_rel_axis(dy, gain, &rem_y);
 }
 
-// Timer Callback function. This will be called when timer expires to detect if then pen was lifted.
-void pen_timer_callback(long unsigned int data)
+// Send a position update (absolute or relative), no sync.
+static void jornada720_ts_report_pos(struct input_dev *input, int x, int y)
 {
-	struct input_dev *input = (struct input_dev*)data;
-	if (input!=NULL) {
+	if (!report_valid) jornada720_ts_stats_latency();
+	ts_stats.reports++;
 
-		// Now Check pen state - if GPIO9 is high it has been lifted.
-		if (GPLR & GPIO_GPIO(9)) {
+	report_valid = 1;
+	report_x = x;
+	report_y = y;
+	report_time = ktime_get();
+	pending = 0;
 
-			// Track pen state
-			pendown=0;
+	// if we play mouse, calculate the movement offset
+	if (relative) {
+		jornada720_ts_get_relxy(&x, &y);  // might need to scale the reported value
+		input_report_rel(input, REL_X, x);
+		input_report_rel(input, REL_Y, y);
+		
+	} else {
+		input_report_abs(input, ABS_X, x);
+		input_report_abs(input, ABS_Y, y);				
+	}
+}
 
-			if (touch_sent) {
-				input_report_key(input, BTN_TOUCH, 0);
-				touch_sent=0;
-			}
+// Returns 1 if the position update should be dropped: too soon after the last one or inside the dead-band.
+// The first position after pen-down is always sent.
+static int jornada720_ts_suppress(int x, int y)
+{
+	if (!report_valid)
+		return 0;
 
-			if (lmb_sent && !lmb_locked) {
-				input_report_key(input, BTN_LEFT, 0);				
-				lmb_sent=0;
-			}
+	return jornada720_ts_suppress_check(&ts_params, ktime_us_delta(ktime_get(), report_time), x - report_x, y - report_y);
+}
 
-			if (mmb_sent) {
-				input_report_key(input, BTN_MIDDLE, 0);	
-				mmb_sent=0;
-			}
+// Close all open button events after the pen was lifted.
+static void jornada720_ts_release(struct input_dev *input)
+{
+	// Track pen state
+	pendown=0;
+	ts_stats.releases++;
+	ts_stats.pendown_ns += ktime_to_ns(ktime_sub(ktime_get(), pendown_start));
+	touch_start_valid=0;
+
+	// Rate limited position that was never sent, the stroke has to end where the pen left
+	// and not where the predictor expected it to go
+	if (report_valid && jornada720_ts_filter_actual(&ts_filter, &ts_params, &pending_x, &pending_y))
+		pending=1;
+	if (pending)
+		jornada720_ts_report_pos(input, pending_x, pending_y);
+	report_valid=0;
+	pending=0;
+
+	if (touch_sent) {
+		input_report_key(input, BTN_TOUCH, 0);
+		touch_sent=0;
+	}
 
-			if (rmb_sent) {
-				input_report_key(input, BTN_RIGHT, 0);
-				rmb_sent=0;
-			}
+	if (lmb_sent && !lmb_locked) {
+		input_report_key(input, BTN_LEFT, 0);				
+		lmb_sent=0;
+	}
+
+	if (mmb_sent) {
+		input_report_key(input, BTN_MIDDLE, 0);	
+		mmb_sent=0;
+	}
 
-			input_sync(input);
-		} 
+	if (rmb_sent) {
+		input_report_key(input, BTN_RIGHT, 0);
+		rmb_sent=0;
 	}
+
+	input_sync(input);
+
 	// Reset the averaging on pen up
 	jornada720_ts_filter_reset();
 
@@ -266,12 +525,193 @@ void pen_timer_callback(long unsigned int data)
 	jornada720_ts_reset_relxy();
 }
 
+// Debounce timer callback, GPIO9 went high pen_debounce usec ago.
+// Still high means this was not a sample pulse, let the thread release the pen.
+static enum hrtimer_restart debounce_timer_callback(struct hrtimer *timer)
+{
+	if (GPLR & GPIO_GPIO(9)) {
+		set_bit(PEN_RELEASE, &pen_flags);
+		irq_wake_thread(IRQ_GPIO9, ts_pdev);
+	}
+	return HRTIMER_NORESTART;
+}
+
+static void jornada720_ts_debounce_start(void)
+{
+	hrtimer_start(&debounce_timer, ns_to_ktime((u64)pen_debounce * NSEC_PER_USEC), HRTIMER_MODE_REL);
+}
+
+// Timer Callback function. Fallback in case the rising edge on pen-up was missed.
+void pen_timer_callback(long unsigned int data)
+{
+	if (!pendown) return;
+
+	// Now Check pen state - if GPIO9 is high it has been lifted.
+	if (GPLR & GPIO_GPIO(9)) {
+		set_bit(PEN_FALLBACK, &pen_flags);
+		set_bit(PEN_RELEASE, &pen_flags);
+		irq_wake_thread(IRQ_GPIO9, ts_pdev);
+	} else {
+		mod_timer(&pen_timer, jiffies + msecs_to_jiffies(TIMEOUT));
+	}
+}
+
+// Process one position sample and send the input events for it.
+static void jornada720_ts_report(struct input_dev *input, int x, int y)
+{
+	struct jornada_ts_cal *cal;
+	int calibrated;
+
+	// Adjust coords if we have calibration data
+	rcu_read_lock();
+	cal = rcu_dereference(ts_cal);
+	calibrated = (cal != NULL);
+	if (calibrated) jornada720_ts_calibrate(cal->a, &x, &y);
+	rcu_read_unlock();
+
+	// If the touchscreen is calibrated activate additional features
+	// drop first coordinate samples if the pen was up before
+	if (calibrated && !pendown) ts_stats.pendown_drops++;
+
+	if (calibrated && pendown) { 
+		// We're in the active area, send the position update
+		if (x<=640) {
+			int keys = 0;
+
+			// smooth out coordinates
+			jornada720_ts_filter(&x, &y);
+
+			// key states are only sent when they change
+			if (lmb<2 && !touch_sent) {
+				input_report_key(input, BTN_TOUCH, 1);
+				touch_sent=1;
+				keys=1;
+			}
+			if ((lmb==1 || lmb==2) && !lmb_sent) {
+				input_report_key(input, BTN_LEFT, 1);
+				lmb_sent=1;
+				keys=1;
+			}
+
+			// nothing new to tell, remember the position for pen-up and don't wake up userspace
+			if (!keys && jornada720_ts_suppress(x, y)) {
+				ts_stats.suppressed++;
+				pending=1;
+				pending_x=x;
+				pending_y=y;
+				return;
+			}
+
+			jornada720_ts_report_pos(input, x, y);
+			input_sync(input);						
+		}					
+		// else we're in the app key area 
+		else {
+			int key = jornada720_ts_softkey(y);
+			int keys = 0;
+
+			ts_stats.softkey_samples++;
+
+			if (key == JORNADA_TS_KEY_SETTINGS) {  //(1) settings hotkey (RMB)
+				// If LMB was locked, release it now.
+				if (lmb==3 && lmb_locked) {
+					input_report_key(input, BTN_LEFT, 0);								
+					lmb_locked=0;
+					keys=1;
+				}							
+
+				// if RMB emulation is active
+				if (rmb && !rmb_sent) { 
+					// Send the RMB event
+					input_report_key(input, BTN_RIGHT, 1);
+					rmb_sent=1;
+					keys=1;
+				}							
+			}
+
+			if (key == JORNADA_TS_KEY_PCCARD) {  // pc card hotkey (2)
+				// if MMB emulation is active
+				if (mmb && !mmb_sent) { 
+					// Send the RMB event
+					input_report_key(input, BTN_MIDDLE, 1);
+					mmb_sent=1;
+					keys=1;
+				}
+			}
+
+			if (key == JORNADA_TS_KEY_PHONE) {  // phone hotkey (3)
+				// reserved for LMB
+				if (lmb==3 && !lmb_locked && !lmb_sent) { 
+					// Send the LMB event
+					input_report_key(input, BTN_LEFT, 1);
+					lmb_sent=1;
+					keys=1;
+				}
+
+				// If LMB was locked, we release it now.
+				if (lmb==3 && lmb_locked) {
+					lmb_locked=0;
+				}
+			}
+
+			if (key == JORNADA_TS_KEY_MEDIA) {  // media hotkey (4)
+				// reserved for LMB lock
+				if (lmb==3 && !lmb_locked) {
+					// Send the LMB event
+					input_report_key(input, BTN_LEFT, 1);
+					lmb_locked=1;
+					keys=1;
+				}
+			}
+
+			// Send app key area update
+			if (keys) input_sync(input);
+		}
+	} 
+	// Just dump the data out if uncalibrated
+	else if (!calibrated) {					
+		jornada720_ts_stats_latency();
+		ts_stats.reports++;
+		input_report_key(input, BTN_TOUCH, 1);
+		input_report_abs(input, ABS_X, x);
+		input_report_abs(input, ABS_Y, y);				
+		input_sync(input);
+		touch_sent=1;
+	}
+}
+
+// Hard IRQ handler, the SSP transfer busy-waits on the MCU so everything is done in the thread.
+// Rising edge: pen lifted or start of a sample pulse, debounce it.
+// Falling edge: new sample available, cancel the debounce and fetch it.
 static irqreturn_t jornada720_ts_interrupt(int irq, void *dev_id)
+{
+	ts_stats.irqs++;
+
+	if (GPLR & GPIO_GPIO(9)) {
+		if (pendown) jornada720_ts_debounce_start();
+		return IRQ_HANDLED;
+	}
+
+	// remember when the touch started for the pen-down latency
+	if (!pendown && !touch_start_valid) {
+		touch_start = ktime_get();
+		touch_start_valid = 1;
+	}
+
+	hrtimer_try_to_cancel(&debounce_timer);
+	set_bit(PEN_SAMPLE, &pen_flags);
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t jornada720_ts_thread(int irq, void *dev_id)
 {
 	struct platform_device *pdev = dev_id;
 	struct jornada_ts *jornada_ts = platform_get_drvdata(pdev);
 	struct input_dev *input = jornada_ts->dev;
+	ktime_t t_start, t_ssp;
 	int x, y;
+	int valid = 0;
+	int error;
 
 	/*
 	From HPs hardware manual:
@@ -288,128 +728,252 @@ static irqreturn_t jornada720_ts_interrupt(int irq, void *dev_id)
 	   Turns out this requires a timer be added after the samples reading part.
 	*/
 
-	// Cancel the pen-up timer for the duration of the below and track pen-down state
-	del_timer(&pen_timer);
+	t_start = ktime_get();
+	ts_stats.threads++;
+
+	// Woken by the debounce or fallback timer: release the pen if it is still up
+	if (test_and_clear_bit(PEN_RELEASE, &pen_flags)) {
+		if (pendown && (GPLR & GPIO_GPIO(9))) {
+			del_timer_sync(&pen_timer);
+			if (test_bit(PEN_FALLBACK, &pen_flags)) ts_stats.fallback_releases++;
+			jornada720_ts_release(input);
+			jornada720_ts_capture(NULL, JORNADA_TS_REC_PENUP);
+			clear_bit(PEN_FALLBACK, &pen_flags);
+			clear_bit(PEN_SAMPLE, &pen_flags);
+			return IRQ_HANDLED;
+		}
+		clear_bit(PEN_FALLBACK, &pen_flags);
+	}
+
+	// Wake-ups coalesce, only fetch when a falling edge came with this one
+	if (!test_and_clear_bit(PEN_SAMPLE, &pen_flags))
+		goto recheck;
 
 	// This was called due to falling edge on GPIO, means: pen must have touched surface and there are coords to fetch.
+	// Only the SSP exchange itself runs with interrupts off, filtering and reporting happen after it.
+	t_ssp = ktime_get();
 	jornada_ssp_start();
 
-	/* proper reply to request is always TXDUMMY */
-	if (jornada_ssp_inout(GETTOUCHSAMPLES) == TXDUMMY) {
-		jornada720_ts_collect_data(jornada_ts);
+	error = jornada720_ts_collect_data(jornada_ts);
+	valid = (error == 0);
 
-		x = jornada720_ts_average(jornada_ts->x_data);
-		y = jornada720_ts_average(jornada_ts->y_data);
+	jornada720_ts_ssp_end();
+	jornada720_ts_stats_hist(ts_stats.ssp_hist, &ts_stats.ssp_max_us, ktime_us_delta(ktime_get(), t_ssp));
 
-		// If the touchscreen is calibrated activate additional features
-		// drop first coordinate samples if the pen was up before
-		if (calibrated && pendown) { 
-			// Adjust coords if we have calibration data
-			jornada720_ts_calibrate(&x, &y);
+	ts_stats.samples++;
+	if (error == -ETIMEDOUT) ts_stats.ssp_timeouts++;
+	else if (!valid) ts_stats.ssp_errors++;
+	if (pendown) ts_stats.pendown_samples++;
 
-			// We're in the active area, send the position update
-			if (x<=640) {
-				// smooth out coordinates if activated.
-				if (filter) jornada720_ts_filter(&x, &y);
+	jornada720_ts_capture(valid ? jornada_ts->raw : NULL, valid ? JORNADA_TS_REC_VALID : 0);
 
-				if (lmb<2) {
-					input_report_key(input, BTN_TOUCH, 1);
-					touch_sent=1;
-				}
-				if (lmb==1 || lmb==2) {
-					input_report_key(input, BTN_LEFT, 1);
-					lmb_sent=1;
-				}
+	if (valid) {
+		x = jornada720_ts_average(jornada_ts->x_data, median);
+		y = jornada720_ts_average(jornada_ts->y_data, median);
 
-				// if we play mouse, calculate the movement offset
-				if (relative) {
-					jornada720_ts_get_relxy(&x, &y);  // might need to scale the reported value
-					input_report_rel(input, REL_X, x);
-					input_report_rel(input, REL_Y, y);
-					
-				} else {
-					input_report_abs(input, ABS_X, x);
-					input_report_abs(input, ABS_Y, y);				
-				}
-				input_sync(input);						
-			}					
-			// else we're in the app key area 
-			else {
-				if (y<=60) {  //(1) settings hotkey (RMB)
-					// If LMB was locked, release it now.
-					if (lmb==3 && lmb_locked) {
-						input_report_key(input, BTN_LEFT, 0);								
-						lmb_locked=0;
-					}							
-
-					// if RMB emulation is active
-					if (rmb) { 
-						// Send the RMB event
-						input_report_key(input, BTN_RIGHT, 1);
-						rmb_sent=1;
-					}							
-				}
+		jornada720_ts_report(input, x, y);
+	}
 
-				if (y<=120 && y>60) {  // pc card hotkey (2)
-					// if MMB emulation is active
-					if (mmb) { 
-						// Send the RMB event
-						input_report_key(input, BTN_MIDDLE, 1);
-						mmb_sent=1;
-					}
-				}
+	// Track pendown state, arm the fallback timer on pen-down
+	if (!pendown) {
+		mod_timer(&pen_timer, jiffies + msecs_to_jiffies(TIMEOUT));
+		pendown_start = ktime_get();
+	}
+	pendown=1;
 
-				if (y<=180 && y>120) {  // phone hotkey (3)
-					// reserved for LMB
-					if (lmb==3 && !lmb_locked) { 
-						// Send the LMB event
-						input_report_key(input, BTN_LEFT, 1);
-						lmb_sent=1;
-					}
-
-					// If LMB was locked, we release it now.
-					if (lmb==3 && lmb_locked) {
-						lmb_locked=0;
-					}
-				}
+recheck:
+	// The edge IRQ is not masked while the thread runs, a falling edge can cancel the debounce of
+	// a pen-up and its wake-up folds into this run. Go by the line level: if it is high, debounce again.
+	if (pendown && (GPLR & GPIO_GPIO(9)) && !hrtimer_active(&debounce_timer))
+		jornada720_ts_debounce_start();
 
-				if (y<=240 && y>180) {  // media hotkey (3)
-					// reserved for LMB lock
-					if (lmb==3 && !lmb_locked) {
-						// Send the LMB event
-						input_report_key(input, BTN_LEFT, 1);
-						lmb_locked=1;
-					}
-				}
+	jornada720_ts_stats_hist(ts_stats.thread_hist, &ts_stats.thread_max_us, ktime_us_delta(ktime_get(), t_start));
 
-				// Send app key area update
-				input_sync(input);
-			}
-		} 
-		// Just dump the data out if uncalibrated
-		else if (!calibrated) {					
-			input_report_key(input, BTN_TOUCH, 1);
-			input_report_abs(input, ABS_X, x);
-			input_report_abs(input, ABS_Y, y);				
-			input_sync(input);
-			touch_sent=1;
-		}
+	return IRQ_HANDLED;
+}
+
+// The calibration can change after the device is registered, so one range covers
+// the screen as well as the raw readings.
+static void jornada720_ts_set_abs_params(struct input_dev *input_dev)
+{
+	input_set_abs_params(input_dev, ABS_X, 0, max(MAXX, RAW_MAXX), 0, 0);
+	input_set_abs_params(input_dev, ABS_Y, 0, max(MAXY, RAW_MAXY), 0, 0);
+}
+
+// Swap in a new calibration matrix, NULL switches to raw coordinates.
+static int jornada720_ts_set_cal(const int *a)
+{
+	struct jornada_ts_cal *cal = NULL, *old;
+
+	if (a) {
+		if (a[6] == 0) return -EINVAL;
+		cal = kmalloc(sizeof(*cal), GFP_KERNEL);
+		if (!cal) return -ENOMEM;
+		memcpy(cal->a, a, sizeof(cal->a));
 	}
-	jornada_ssp_end();
 
-	// Track pendown state.
-	pendown=1;
+	mutex_lock(&ts_cal_mutex);
+	old = rcu_dereference_protected(ts_cal, lockdep_is_held(&ts_cal_mutex));
+	rcu_assign_pointer(ts_cal, cal);
+	mutex_unlock(&ts_cal_mutex);
 
-    /* setup a timer to check for the pen-up state in 50msec */
-    mod_timer(&pen_timer, jiffies + msecs_to_jiffies(TIMEOUT));
+	if (old) kfree_rcu(old, rcu);
+	return 0;
+}
 
-	return IRQ_HANDLED;
+// Convert the legacy gain/offset parameters (1/1024) including axis inversion into a matrix.
+static void jornada720_ts_legacy_cal(int *a)
+{
+	a[0] = mx;
+	a[1] = 0;
+	a[2] = (dx + ((mx<0) ? MAXX : 0)) * 1024;
+	a[3] = 0;
+	a[4] = my;
+	a[5] = (dy + ((my<0) ? MAXY : 0)) * 1024;
+	a[6] = 1024;
+}
+
+/*
+ * sysfs: /sys/bus/platform/devices/jornada_ts/calibration
+ * read/write "a0 a1 a2 a3 a4 a5 a6" (tslib pointercal format) or "none" for raw coordinates
+ */
+static ssize_t jornada720_ts_calibration_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jornada_ts_cal *cal;
+	ssize_t len;
+
+	rcu_read_lock();
+	cal = rcu_dereference(ts_cal);
+	if (cal)
+		len = sprintf(buf, "%d %d %d %d %d %d %d\n", cal->a[0], cal->a[1], cal->a[2],
+			      cal->a[3], cal->a[4], cal->a[5], cal->a[6]);
+	else
+		len = sprintf(buf, "none\n");
+	rcu_read_unlock();
+
+	return len;
+}
+
+static ssize_t jornada720_ts_calibration_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int a[7];
+	int error;
+
+	if (sysfs_streq(buf, "none")) {
+		// raw coordinates are absolute, a relative device has no axes for them
+		if (relative) return -EINVAL;
+		error = jornada720_ts_set_cal(NULL);
+	} else {
+		if (sscanf(buf, "%d %d %d %d %d %d %d", &a[0], &a[1], &a[2], &a[3], &a[4], &a[5], &a[6]) != 7)
+			return -EINVAL;
+		error = jornada720_ts_set_cal(a);
+	}
+
+	return error ? error : count;
+}
+
+static DEVICE_ATTR(calibration, 0644, jornada720_ts_calibration_show, jornada720_ts_calibration_store);
+
+static struct attribute *jornada720_ts_attrs[] = {
+	&dev_attr_calibration.attr,
+	NULL
+};
+
+static const struct attribute_group jornada720_ts_attr_group = {
+	.attrs = jornada720_ts_attrs,
+};
+
+/*
+ * sysfs: /sys/bus/platform/devices/jornada_ts/statistics/
+ * counters, histogram (IRQ thread and SSP time), latency; write anything to reset to clear them
+ */
+static ssize_t jornada720_ts_counters_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jornada_ts_stats *st = &ts_stats;
+	u32 rate = 0;
+
+	// samples per second while the pen is down
+	if (st->pendown_ns > 0)
+		rate = (u32)div64_s64((s64)st->pendown_samples * NSEC_PER_SEC, st->pendown_ns);
+
+	return sprintf(buf,
+		"irqs %lu\n"
+		"threads %lu\n"
+		"samples %lu\n"
+		"ssp_errors %lu\n"
+		"pendown_drops %lu\n"
+		"softkey_samples %lu\n"
+		"suppressed %lu\n"
+		"reports %lu\n"
+		"releases %lu\n"
+		"fallback_releases %lu\n"
+		"ssp_timeouts %lu\n"
+		"kbd_waits %lu\n"
+		"pendown_ms %lld\n"
+		"sample_rate %u\n",
+		st->irqs, st->threads, st->samples, st->ssp_errors, st->pendown_drops,
+		st->softkey_samples, st->suppressed, st->reports, st->releases,
+		st->fallback_releases, st->ssp_timeouts, st->kbd_waits, div_s64(st->pendown_ns, NSEC_PER_MSEC), rate);
+}
+
+static ssize_t jornada720_ts_histogram_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jornada_ts_stats *st = &ts_stats;
+	ssize_t len;
+	int i;
+
+	len = sprintf(buf, "%-10s %10s %10s\n", "usec", "thread", "ssp");
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		len += sprintf(buf + len, "%-10u %10lu %10lu\n",
+			       i ? 1U << (i - 1) : 0, st->thread_hist[i], st->ssp_hist[i]);
+	}
+	len += sprintf(buf + len, "%-10s %10u %10u\n", "max", st->thread_max_us, st->ssp_max_us);
+
+	return len;
 }
 
+static ssize_t jornada720_ts_latency_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jornada_ts_stats *st = &ts_stats;
+	u32 avg = 0;
+
+	if (st->latency_count)
+		avg = (u32)div_u64(st->latency_sum_us, st->latency_count);
+
+	return sprintf(buf, "last %u\nmin %u\navg %u\nmax %u\ncount %lu\n",
+		       st->latency_last_us, st->latency_min_us, avg, st->latency_max_us, st->latency_count);
+}
+
+static ssize_t jornada720_ts_reset_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	memset(&ts_stats, 0, sizeof(ts_stats));
+	return count;
+}
+
+static DEVICE_ATTR(counters, 0444, jornada720_ts_counters_show, NULL);
+static DEVICE_ATTR(histogram, 0444, jornada720_ts_histogram_show, NULL);
+static DEVICE_ATTR(latency, 0444, jornada720_ts_latency_show, NULL);
+static DEVICE_ATTR(reset, 0200, NULL, jornada720_ts_reset_store);
+
+static struct attribute *jornada720_ts_stats_attrs[] = {
+	&dev_attr_counters.attr,
+	&dev_attr_histogram.attr,
+	&dev_attr_latency.attr,
+	&dev_attr_reset.attr,
+	NULL
+};
+
+static const struct attribute_group jornada720_ts_stats_group = {
+	.name = "statistics",
+	.attrs = jornada720_ts_stats_attrs,
+};
+
 static int jornada720_ts_probe(struct platform_device *pdev)
 {
 	struct jornada_ts *jornada_ts;
 	struct input_dev *input_dev;
+	int calibrated;
+	int a[7];
 	int error;
 
 	jornada_ts = kzalloc(sizeof(struct jornada_ts), GFP_KERNEL);
@@ -430,19 +994,23 @@ static int jornada720_ts_probe(struct platform_device *pdev)
 	input_dev->dev.parent = &pdev->dev;
 
 	// did we get calibration data?
-	if (mx!=1024 && my!=1024) {
+	if (matrix_count==7 && matrix[6]!=0) {
+		calibrated=1;
+		memcpy(a, matrix, sizeof(a));
+		printk(KERN_INFO "HP7XX TS : Calibration matrix %d %d %d %d %d %d %d\n", a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+	}
+	else if (mx!=1024 && my!=1024) {
 		calibrated=1;
+		jornada720_ts_legacy_cal(a);
 		printk(KERN_INFO "HP7XX TS : Calibration data mx %d dx %d, my %d dy %d\n", mx, dx, my, dy);
 	} 
 	// default stupid touchscreen.
+	// Buttons and filters stay configured and start with the first matrix written through sysfs,
+	// relative mode changes the event types of the input device and needs calibration at load time.
 	else {
 		calibrated=0;
-		lmb=0;
-		rmb=0;
-		mmb=0;
-		filter=0;
 		relative=0;
-		printk(KERN_INFO "HP7XX TS : Uncalibrated mode, disabling advanced features. Provide calibration data to use them.");
+		printk(KERN_INFO "HP7XX TS : Uncalibrated mode, advanced features start when calibration data is written to sysfs.\n");
 	}
 
 	input_dev->evbit[0] |= BIT_MASK(EV_KEY);
@@ -453,14 +1021,12 @@ static int jornada720_ts_probe(struct platform_device *pdev)
 		input_dev->relbit[0] = BIT_MASK(REL_X) | BIT_MASK(REL_Y);
 	} else {
 		input_dev->evbit[0] |= BIT_MASK(EV_ABS);
-		if (calibrated) {
-			input_set_abs_params(input_dev, ABS_X, 0, MAXX, 8, 0);			
-			input_set_abs_params(input_dev, ABS_Y, 0, MAXY, 8, 0);
-		} else {
-			// default if uncalibrated.
-			input_set_abs_params(input_dev, ABS_X, 270, 3900, 0, 0);
-			input_set_abs_params(input_dev, ABS_Y, 180, 3700, 0, 0);
-		}			
+		jornada720_ts_set_abs_params(input_dev);
+	}
+
+	if (calibrated) {
+		error = jornada720_ts_set_cal(a);
+		if (error) goto fail1;
 	}
 
 	// __set_bit(ABS_MISC, input_dev->absbit); // does this help with anything?
@@ -470,12 +1036,16 @@ static int jornada720_ts_probe(struct platform_device *pdev)
 		lmb=3;
 		rmb=1;
 		mmb=1;
+		if (rel_gain<0) rel_gain=0;
+		if (rel_accel<0) rel_accel=0;
 		printk(KERN_INFO "HP7XX TS : Relative mode active, re-configuring mouse button settings.\n");
+		printk(KERN_INFO "HP7XX TS : Relative gain %d/256, acceleration %d/256 per pixel.\n", rel_gain, rel_accel);
 	}
 
-	// Activate LMB / RMB reporting if emulation on and not in relative mode
+	// Activate LMB / RMB reporting if emulation on and not in relative mode.
+	// Raw coordinates always come with touch, the key is there for a later switch to "none".
+	__set_bit(BTN_TOUCH, input_dev->keybit);
 	if (lmb<2) {
-		__set_bit(BTN_TOUCH, input_dev->keybit);
 		printk(KERN_INFO "HP7XX TS : Touch events active.\n");
 	}
 	if (lmb) {
@@ -502,14 +1072,50 @@ static int jornada720_ts_probe(struct platform_device *pdev)
 	}
 
 	// clamp filter parameter to acceptable range
-	if (filter<0) filter=0;
-	if (filter>XY_HISTORY) filter=XY_HISTORY;
-	if (filter) {
-		printk(KERN_INFO "HP7XX TS : X/Y averaging filter active with %d samples.\n", filter);
+	ts_params.median = median;
+	ts_params.filter = filter;
+	ts_params.iir = iir;
+	ts_params.euro = euro;
+	ts_params.euro_mincutoff = euro_mincutoff;
+	ts_params.euro_beta = euro_beta;
+	ts_params.predict = predict;
+	ts_params.max_rate = max_rate;
+	ts_params.deadband = deadband;
+	jornada720_ts_params_clamp(&ts_params);
+
+	if (ts_params.filter) {
+		printk(KERN_INFO "HP7XX TS : X/Y averaging filter active with %d samples.\n", ts_params.filter);
+	}
+	if (ts_params.iir) {
+		printk(KERN_INFO "HP7XX TS : X/Y IIR filter active, factor 1/%d.\n", 1 << ts_params.iir);
+	}
+	if (ts_params.euro) {
+		printk(KERN_INFO "HP7XX TS : X/Y 1-euro filter active, mincutoff %d/100 Hz, beta %d/1000.\n", ts_params.euro_mincutoff, ts_params.euro_beta);
+	}
+	if (ts_params.median) {
+		printk(KERN_INFO "HP7XX TS : Median of 3 raw samples active.\n");
+	}
+	if (ts_params.predict) {
+		printk(KERN_INFO "HP7XX TS : Position prediction active, %d msec ahead.\n", ts_params.predict);
+	}
+	if (ts_params.max_rate || ts_params.deadband) {
+		printk(KERN_INFO "HP7XX TS : Report limiting active, max. %d/s, dead-band %d pixels.\n", ts_params.max_rate, ts_params.deadband);
 	}
 
-	// Changed to trigger on falling edge
-	error = request_irq(IRQ_GPIO9, jornada720_ts_interrupt, IRQF_TRIGGER_FALLING, "HP7XX Touchscreen driver", pdev);
+	if (pen_debounce<100) pen_debounce=100;
+	if (pen_debounce>20000) pen_debounce=20000;
+
+	jornada720_ts_filter_reset();
+
+	// Setup pen-up timers, do not start yet
+	ts_pdev = pdev;
+	hrtimer_init(&debounce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	debounce_timer.function = debounce_timer_callback;
+	setup_timer(&pen_timer, pen_timer_callback, 0);
+
+	// Trigger on both edges: falling for new samples, rising for pen-up. Sampling runs in the IRQ thread
+	error = request_threaded_irq(IRQ_GPIO9, jornada720_ts_interrupt, jornada720_ts_thread,
+				     IRQF_TRIGGER_FALLING | IRQF_TRIGGER_RISING | IRQF_ONESHOT, "HP7XX Touchscreen driver", pdev);
 	if (error) {
 		printk(KERN_INFO "HP7XX TS : Unable to acquire irq!\n");
 		goto fail1;
@@ -518,32 +1124,30 @@ static int jornada720_ts_probe(struct platform_device *pdev)
 	error = input_register_device(jornada_ts->dev);
 	if (error) goto fail2;
 
-	// If we have calibration data, report a reasonable screen size
-	// and process inverted axes if needed.
-	if (calibrated) {
-		// Handle axis inversion
-		if (mx<0) {
-			printk(KERN_INFO "HP7XX TS : Inverted X Axis\n");
-			x_invert = 1;
-			mx = mx * -1;
-			dx = dx * -1;
-		}
-		if (my<0) {
-			printk(KERN_INFO "HP7XX TS : Inverted Y Axis\n");
-			y_invert = 1;
-			my = my * -1;
-			dy = dy * -1;
-		}
-	}	
+	// Runtime calibration interface
+	error = sysfs_create_group(&pdev->dev.kobj, &jornada720_ts_attr_group);
+	if (error) goto fail3;
+
+	// Sampling statistics
+	error = sysfs_create_group(&pdev->dev.kobj, &jornada720_ts_stats_group);
+	if (error) goto fail4;
 
-	// Setup pen-up timer, do not start yet
-    setup_timer(&pen_timer, pen_timer_callback, (long unsigned int)input_dev);
+	// Raw sample capture for tools/j720_tsreplay
+	jornada720_ts_capture_init();
 
 	return 0;
 
+ fail4:
+	sysfs_remove_group(&pdev->dev.kobj, &jornada720_ts_attr_group);
+ fail3:
+	input_unregister_device(input_dev);
+	input_dev = NULL;
  fail2:
 	free_irq(IRQ_GPIO9, pdev);
+	hrtimer_cancel(&debounce_timer);
+	del_timer_sync(&pen_timer);
  fail1:
+	jornada720_ts_set_cal(NULL);
 	input_free_device(input_dev);
 	kfree(jornada_ts);
 	return error;
@@ -553,11 +1157,17 @@ static int jornada720_ts_remove(struct platform_device *pdev)
 {
 	struct jornada_ts *jornada_ts = platform_get_drvdata(pdev);
 
-    /* remove the pen-timer when unloading module */
-    del_timer(&pen_timer);
-
+	jornada720_ts_capture_exit();
+	sysfs_remove_group(&pdev->dev.kobj, &jornada720_ts_stats_group);
+	sysfs_remove_group(&pdev->dev.kobj, &jornada720_ts_attr_group);
 	free_irq(IRQ_GPIO9, pdev);
+
+    /* remove the pen-timers when unloading module */
+    hrtimer_cancel(&debounce_timer);
+    del_timer_sync(&pen_timer);
+
 	input_unregister_device(jornada_ts->dev);
+	jornada720_ts_set_cal(NULL);
 	kfree(jornada_ts);
 
 	return 0;
@@ -0,0 +1,383 @@
+/*
+ * drivers/input/touchscreen/jornada720_ts.h
+ *
+ * Copyright (C) 2022 Timo Biesenbach <timo.biesenbach@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * HP Jornada 710/720/729 Touchscreen Driver - sample processing
+ *
+ * Filter chain, calibration, report limiting and softkey decoding. Nothing
+ * in here touches hardware or driver state, so the same code is built into
+ * the driver and into tools/j720_tsreplay for replaying recorded samples.
+ */
+#ifndef JORNADA720_TS_H
+#define JORNADA720_TS_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/stddef.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#else
+// host build shims
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t  u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+static inline u64 div_u64(u64 dividend, u32 divisor) { return dividend / divisor; }
+static inline s64 div_s64(s64 dividend, int32_t divisor) { return dividend / divisor; }
+#endif
+
+// screen size
+#define MAXX 640
+#define MAXY 240
+
+// highest raw ADC readings at the screen edges, reported as they are while uncalibrated
+#define RAW_MAXX 3900
+#define RAW_MAXY 3700
+
+/*
+ * Raw capture record, one per MCU sample or pen-up. Layout is shared with
+ * the debugfs "raw" file and tools/j720_tsreplay.
+ */
+#define JORNADA_TS_REC_VALID	0x01	// MCU answered GETTOUCHSAMPLES with TXDUMMY, data is valid
+#define JORNADA_TS_REC_PENUP	0x02	// pen-up detected, no data
+#define JORNADA_TS_REC_OVERFLOW	0x04	// records were lost before this one
+
+struct jornada_ts_record {
+	u64 time_ns;	// ktime_get() timestamp
+	u8 data[8];		// SSP bytes in MCU order: x0 x1 x2 y0 y1 y2 xhigh yhigh
+	u8 flags;
+	u8 pad[7];
+};
+
+// Tunables of the sample processing, see the module parameters for their meaning.
+struct jornada_ts_params {
+	int median;
+	int filter;
+	int iir;
+	int euro;
+	int euro_mincutoff;
+	int euro_beta;
+	int predict;
+	int max_rate;
+	int deadband;
+};
+
+// Filter chain state, coordinates of the IIR and 1-euro stages are kept in 1/256 pixel
+#define XY_HISTORY 100
+#define FILTER_SHIFT 8
+#define EURO_DCUTOFF 100	// cutoff for the speed estimate in 1/100 Hz
+#define EURO_MAX_CUTOFF 1000000	// 10 kHz, far above the sample rate, alpha is 1 there
+#define EURO_MAX_BETA 100000	// 100 Hz per pixel/s
+#define EURO_MAX_DT 100000	// usec, longer gaps restart the filter
+#define PREDICT_MAX_MS 50	// longest prediction horizon
+#define PREDICT_MAX_PX 32	// longest extrapolation in pixels
+
+// Limits of the tunables, the driver applies them to the module parameters and the replay tool to its options.
+static inline void jornada720_ts_params_clamp(struct jornada_ts_params *p) {
+	if (p->filter < 0) p->filter = 0;
+	if (p->filter > XY_HISTORY) p->filter = XY_HISTORY;
+	if (p->iir < 0) p->iir = 0;
+	if (p->iir > 6) p->iir = 6;
+	if (p->euro_mincutoff < 1) p->euro_mincutoff = 1;
+	if (p->euro_mincutoff > EURO_MAX_CUTOFF) p->euro_mincutoff = EURO_MAX_CUTOFF;
+	if (p->euro_beta < 0) p->euro_beta = 0;
+	if (p->euro_beta > EURO_MAX_BETA) p->euro_beta = EURO_MAX_BETA;
+	if (p->predict < 0) p->predict = 0;
+	if (p->predict > PREDICT_MAX_MS) p->predict = PREDICT_MAX_MS;
+	if (p->max_rate < 0) p->max_rate = 0;
+	if (p->deadband < 0) p->deadband = 0;
+}
+
+struct jornada_ts_filter {
+	/* running-sum box filter */
+	int box_x[XY_HISTORY];
+	int box_y[XY_HISTORY];
+	int box_sum_x, box_sum_y;
+	int box_count;		// number of samples in history
+	int box_ptr;		// next slot to overwrite
+
+	/* fixed-point IIR */
+	int iir_valid;
+	int iir_x, iir_y;
+
+	/* 1-euro */
+	int euro_valid;
+	s64 euro_x, euro_y;		// filtered position
+	s64 euro_dx, euro_dy;	// filtered speed in 1/256 pixel/s
+
+	/* predictor */
+	int pred_valid;
+	int pred_x, pred_y;		// last position before prediction
+	int pred_vx, pred_vy;	// velocity in 1/256 pixel/ms
+	int pred_ax, pred_ay;	// acceleration in 1/256 pixel/ms^2
+};
+
+/* One stage of the filter chain, runs if the int at offset enable in jornada_ts_params is set */
+struct jornada_ts_stage {
+	const char *name;
+	size_t enable;
+	void (*apply)(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us);
+};
+
+// Softkey area right of the screen (x > MAXX)
+enum jornada_ts_softkey {
+	JORNADA_TS_KEY_SETTINGS = 1,	// (1) settings hotkey
+	JORNADA_TS_KEY_PCCARD,			// (2) pc card hotkey
+	JORNADA_TS_KEY_PHONE,			// (3) phone hotkey
+	JORNADA_TS_KEY_MEDIA,			// (4) media hotkey
+};
+
+// Split the 8 SSP bytes into the x and y sample sets.
+static inline void jornada720_ts_unpack(const u8 data[8], int x_data[4], int y_data[4])
+{
+	x_data[0] = data[0];
+	x_data[1] = data[1];
+	x_data[2] = data[2];
+	y_data[0] = data[3];
+	y_data[1] = data[4];
+	y_data[2] = data[5];
+	x_data[3] = data[6];
+	y_data[3] = data[7];
+}
+
+// Combine the 3 raw MCU samples of one axis into a coordinate.
+// The median drops a single outlier completely, the average just spreads it.
+static inline int jornada720_ts_average(const int coords[4], int median)
+{
+	int a, b, c, t;
+	int high_bits = coords[3];
+
+	a = coords[0] | ((high_bits & 0x03) << 8);
+	b = coords[1] | ((high_bits & 0x0c) << 6);
+	c = coords[2] | ((high_bits & 0x30) << 4);
+
+	if (!median)
+		return (a + b + c) / 3;
+
+	if (a > b) { t = a; a = b; b = t; }
+	if (b > c) b = c;
+	return (a > b) ? a : b;
+}
+
+// rolling average smoothing filter
+// keeps the last filter samples in a ring and a running sum of them, so
+// every sample costs one add and one subtract regardless of the length
+static inline void jornada720_ts_box(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us) {
+	if (f->box_count == p->filter) {
+		f->box_sum_x -= f->box_x[f->box_ptr];
+		f->box_sum_y -= f->box_y[f->box_ptr];
+	} else {
+		f->box_count++;
+	}
+
+	f->box_x[f->box_ptr] = *px;
+	f->box_y[f->box_ptr] = *py;
+	f->box_sum_x += *px;
+	f->box_sum_y += *py;
+
+	f->box_ptr++;
+	if (f->box_ptr >= p->filter) f->box_ptr = 0;
+
+	*px = f->box_sum_x / f->box_count;
+	*py = f->box_sum_y / f->box_count;
+}
+
+// exponential smoothing in fixed point: out += (in - out) >> iir
+static inline void jornada720_ts_iir(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us) {
+	int tx = *px << FILTER_SHIFT;
+	int ty = *py << FILTER_SHIFT;
+
+	if (!f->iir_valid) {
+		f->iir_x = tx;
+		f->iir_y = ty;
+		f->iir_valid = 1;
+	} else {
+		f->iir_x += (tx - f->iir_x) >> p->iir;
+		f->iir_y += (ty - f->iir_y) >> p->iir;
+	}
+
+	*px = (f->iir_x + (1 << (FILTER_SHIFT-1))) >> FILTER_SHIFT;
+	*py = (f->iir_y + (1 << (FILTER_SHIFT-1))) >> FILTER_SHIFT;
+}
+
+// Smoothing factor of a first order low pass with cutoff fc (1/100 Hz) at sample interval dt, in 1/65536.
+// alpha = dt / (dt + tau), tau = 1 / (2 * pi * fc)
+static inline u32 jornada720_ts_euro_alpha(u32 dt_us, u32 fc) {
+	u32 tau_us;
+
+	if (fc < 1) fc = 1;
+	tau_us = 15915494 / fc;		// 10^8 / (2 * pi)
+	return (u32)div_u64((u64)dt_us << 16, dt_us + tau_us);
+}
+
+static inline int jornada720_ts_euro_axis(const struct jornada_ts_params *p, s64 *pos, s64 *speed, int coord, u32 dt_us) {
+	s64 x = (s64)coord << FILTER_SHIFT;
+	s64 dx, abs_dx;
+	u64 fc;
+
+	// speed estimate, low passed with a fixed cutoff
+	dx = div_s64((x - *pos) * 1000000, dt_us);
+	*speed += ((dx - *speed) * jornada720_ts_euro_alpha(dt_us, EURO_DCUTOFF)) >> 16;
+
+	// raise the cutoff with the speed: fc = mincutoff + beta * |speed|
+	abs_dx = (*speed < 0) ? -*speed : *speed;
+	fc = p->euro_mincutoff + div_u64((u64)p->euro_beta * (u64)(abs_dx >> FILTER_SHIFT), 10);
+	if (fc > EURO_MAX_CUTOFF) fc = EURO_MAX_CUTOFF;
+
+	*pos += ((x - *pos) * jornada720_ts_euro_alpha(dt_us, (u32)fc)) >> 16;
+
+	return (int)((*pos + (1 << (FILTER_SHIFT-1))) >> FILTER_SHIFT);
+}
+
+// speed adaptive 1-euro filter (Casiez et al.), strong smoothing at rest, weak during strokes
+static inline void jornada720_ts_euro(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us) {
+	if (!f->euro_valid || dt_us == 0 || dt_us > EURO_MAX_DT) {
+		f->euro_x = (s64)*px << FILTER_SHIFT;
+		f->euro_y = (s64)*py << FILTER_SHIFT;
+		f->euro_dx = 0;
+		f->euro_dy = 0;
+		f->euro_valid = 1;
+		return;
+	}
+
+	*px = jornada720_ts_euro_axis(p, &f->euro_x, &f->euro_dx, *px, dt_us);
+	*py = jornada720_ts_euro_axis(p, &f->euro_y, &f->euro_dy, *py, dt_us);
+}
+
+static inline int jornada720_ts_predict_axis(const struct jornada_ts_params *p, int *last, int *v, int *a, int coord, u32 dt_us) {
+	int vn, an, h = p->predict;
+	s64 ext;
+
+	vn = (int)div_s64(((s64)(coord - *last) << FILTER_SHIFT) * 1000, dt_us);
+	*last = coord;
+
+	// direction change: forget the history, a stale velocity would overshoot the turn
+	if ((vn > 0 && *v < 0) || (vn < 0 && *v > 0)) {
+		*v = 0;
+		*a = 0;
+		return coord;
+	}
+
+	an = (int)div_s64((s64)(vn - *v) * 1000, dt_us);
+	*v += (vn - *v) >> 1;
+	*a += (an - *a) >> 1;
+
+	// x + v * h + a * h^2 / 2, the acceleration may slow the extrapolation down but never reverse it
+	ext = ((s64)*v * h + ((s64)*a * h * h) / 2) >> FILTER_SHIFT;
+	if ((ext > 0 && *v <= 0) || (ext < 0 && *v >= 0)) ext = 0;
+	if (ext >  PREDICT_MAX_PX) ext =  PREDICT_MAX_PX;
+	if (ext < -PREDICT_MAX_PX) ext = -PREDICT_MAX_PX;
+
+	return coord + (int)ext;
+}
+
+// extrapolate the position predict ms ahead from velocity and acceleration,
+// hides part of the sampling, filter and display latency while drawing
+static inline void jornada720_ts_predict(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us) {
+	if (!f->pred_valid || dt_us == 0 || dt_us > EURO_MAX_DT) {
+		f->pred_x = *px;
+		f->pred_y = *py;
+		f->pred_vx = f->pred_vy = 0;
+		f->pred_ax = f->pred_ay = 0;
+		f->pred_valid = 1;
+		return;
+	}
+
+	*px = jornada720_ts_predict_axis(p, &f->pred_x, &f->pred_vx, &f->pred_ax, *px, dt_us);
+	*py = jornada720_ts_predict_axis(p, &f->pred_y, &f->pred_vy, &f->pred_ay, *py, dt_us);
+
+	if (*px < 0) *px = 0;
+	if (*py < 0) *py = 0;
+	if (*px > MAXX) *px = MAXX;
+	if (*py > MAXY) *py = MAXY;
+}
+
+// Filter chain, applied in this order to calibrated coordinates. The predictor has to stay last.
+static const struct jornada_ts_stage jornada720_ts_stages[] = {
+	{ "box",     offsetof(struct jornada_ts_params, filter),  jornada720_ts_box     },
+	{ "iir",     offsetof(struct jornada_ts_params, iir),     jornada720_ts_iir     },
+	{ "1-euro",  offsetof(struct jornada_ts_params, euro),    jornada720_ts_euro    },
+	{ "predict", offsetof(struct jornada_ts_params, predict), jornada720_ts_predict },
+};
+
+// Run the filter chain, dt_us is the time since the previous sample, 0 for the first one after pen-down.
+static inline void jornada720_ts_filter_apply(struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py, u32 dt_us) {
+	const struct jornada_ts_stage *stage;
+	int i;
+
+	for (i=0; i<ARRAY_SIZE(jornada720_ts_stages); i++) {
+		stage = &jornada720_ts_stages[i];
+		if (*(const int *)((const char *)p + stage->enable))
+			stage->apply(f, p, px, py, dt_us);
+	}
+}
+
+static inline void jornada720_ts_filter_init(struct jornada_ts_filter *f) {
+	memset(f, 0, sizeof(*f));
+}
+
+// Last position before the predictor, where the pen really is. Returns 0 if there is none.
+static inline int jornada720_ts_filter_actual(const struct jornada_ts_filter *f, const struct jornada_ts_params *p, int *px, int *py) {
+	if (!p->predict || !f->pred_valid)
+		return 0;
+
+	*px = f->pred_x;
+	*py = f->pred_y;
+	return 1;
+}
+
+// Affine calibration, corrects offset, scale, rotation and skew. a[] in tslib pointercal layout.
+static inline void jornada720_ts_calibrate(const int a[7], int *px, int *py) {
+	s64 x = *px;
+	s64 y = *py;
+	int tx, ty;
+
+	tx = (int)div_s64(a[2] + a[0] * x + a[1] * y, a[6]);
+	ty = (int)div_s64(a[5] + a[3] * x + a[4] * y, a[6]);
+
+	// Handle potential negative values
+	if (tx<0) tx=0;
+	if (ty<0) ty=0;
+
+	*px = tx;
+	*py = ty;
+}
+
+// Returns 1 if a position update should be dropped: since_us after the last one or
+// inside the dead-band around it. The caller always sends the first one after pen-down.
+static inline int jornada720_ts_suppress_check(const struct jornada_ts_params *p, s64 since_us, int dx, int dy)
+{
+	if (p->max_rate && since_us < 1000000 / p->max_rate)
+		return 1;
+
+	if (p->deadband && abs(dx) <= p->deadband && abs(dy) <= p->deadband)
+		return 1;
+
+	return 0;
+}
+
+// Which softkey is at height y of the softkey area, 0 for none
+static inline int jornada720_ts_softkey(int y)
+{
+	if (y<=60)  return JORNADA_TS_KEY_SETTINGS;
+	if (y<=120) return JORNADA_TS_KEY_PCCARD;
+	if (y<=180) return JORNADA_TS_KEY_PHONE;
+	if (y<=240) return JORNADA_TS_KEY_MEDIA;
+	return 0;
+}
+
+// From top ifndef
+#endif
@@ -15,7 +15,7 @@
  *	 - check_var(), mode change, etc.
  *	 - probably not SMP safe :)
  *       - support all bitblt operations on all cards
- *         - added 16bit blitting support. 1bit not working.
+ *         - added 16bit write blit and 1bit color expand blit.
  *
  * This file is subject to the terms and conditions of the GNU General Public
  * License. See the file COPYING in the main directory of this archive for
@@ -33,6 +33,16 @@
 #include <linux/spinlock_types.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+#include <linux/hardirq.h>
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/console.h>
+#include <linux/debugfs.h>
+#include <linux/math64.h>
 
 #include <asm/io.h>
 
@@ -59,11 +69,70 @@
 #define dbg_blit(fmt, args...)
 #endif
 
+/*
+ * shadow framebuffer for mmap clients, see s1d13xxxfb_shadow_init()
+ */
+static int shadow = 0;
+module_param(shadow, int, 0444);
+MODULE_PARM_DESC(shadow, "Draw into a RAM shadow and flush changed tiles to VRAM (0/1)");
+
+static int shadow_fps = 25;
+module_param(shadow_fps, int, 0644);
+MODULE_PARM_DESC(shadow_fps, "Shadow flushes per second (1-100)");
+
+static int shadow_tile = 16;
+module_param(shadow_tile, int, 0644);
+MODULE_PARM_DESC(shadow_tile, "Shadow compare tile size in pixels (4-128)");
+
+/*
+ * fb_cursor on the Ink/Cursor unit, the image lives at the top of VRAM
+ */
+static int hwcursor = 1;
+module_param(hwcursor, int, 0444);
+MODULE_PARM_DESC(hwcursor, "Use the Ink/Cursor unit for the console cursor (0/1)");
+
+static int ink = 1;
+module_param(ink, int, 0444);
+MODULE_PARM_DESC(ink, "Reserve VRAM for the Ink layer overlay (0/1)");
+
+/*
+ * VRAM kept out of the virtual screen for the glyph cache and friends
+ */
+static int offscreen = 64;
+module_param(offscreen, int, 0444);
+MODULE_PARM_DESC(offscreen, "KiB of VRAM below the virtual screen for offscreen use");
+
+static int glyph_cache = 1;
+module_param(glyph_cache, int, 0444);
+MODULE_PARM_DESC(glyph_cache, "Draw the console with tile ops from glyphs cached in VRAM (0/1)");
+
+/* keep the screen over suspend instead of having every client repaint */
+static int vram_save = 1;
+module_param(vram_save, int, 0644);
+MODULE_PARM_DESC(vram_save, "Save VRAM over suspend: 0 = no, 1 = used areas, 2 = used areas, RLE packed");
+
 /*
  * we make sure only one bitblt operation is running
  */
 static DEFINE_SPINLOCK(s1d13xxxfb_bitblt_lock);
 
+/*
+ * the Ink/Cursor unit is shared by fbcon's cursor and the ink ioctls,
+ * taken before the bitblt lock
+ */
+static DEFINE_SPINLOCK(s1d13xxxfb_cursor_lock);
+
+/*
+ * blits return right after kick-off, s1d13xxxfb_sync() busy-polls the
+ * engine. s1d13xxxfb_sync_sleep() polls BBLT_SYNC_SPINS times and then
+ * sleeps, for the callers that are known to run in process context.
+ */
+#define BBLT_SYNC_SPINS		256
+#define BBLT_SYNC_TIMEOUT_MS	100
+
+/* a frame is well below this, even on a CRT */
+#define VSYNC_TIMEOUT_MS	100
+
 /*
  * list of card production ids
  */
@@ -89,12 +158,25 @@ static struct fb_fix_screeninfo s1d13xxxfb_fix = {
 	.id		= S1D_FBID,
 	.type		= FB_TYPE_PACKED_PIXELS,
 	.visual		= FB_VISUAL_PSEUDOCOLOR,
-	.xpanstep	= 0,
+	.xpanstep	= 1,
 	.ypanstep	= 1,
 	.ywrapstep	= 0,
 	.accel		= FB_ACCEL_NONE,
 };
 
+static int s1d13xxxfb_sync(struct fb_info *info);
+static int s1d13xxxfb_sync_sleep(struct fb_info *info);
+static int s1d13xxxfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *info);
+#ifdef CONFIG_FB_TILEBLITTING
+static void s1d13xxxfb_glyph_cache_init(struct fb_info *info);
+#endif
+static void bltbit_invalidate(struct s1d13xxxfb_par *par);
+#ifdef CONFIG_FB_DEFERRED_IO
+static void s1d13xxxfb_shadow_invalidate(struct fb_info *info);
+static int s1d13xxxfb_mmap(struct fb_info *info, struct vm_area_struct *vma);
+static struct fb_ops s1d13xxxfb_fbops;
+#endif
+
 static inline u8
 s1d13xxxfb_readreg(struct s1d13xxxfb_par *par, u16 regno)
 {
@@ -198,6 +280,65 @@ s1d13xxxfb_setup_truecolour(struct fb_info *info)
 	info->var.blue.offset = 0;
 }
 
+/**
+ *	s1d13xxxfb_check_var - validates a var before set_par
+ *	@var  : the requested mode, rounded up where possible
+ *	@info : frame buffer structure
+ *
+ *	The panel timing comes from the platform init and stays, only the
+ *	depth, virtual size and pan offsets can be changed. The line offset
+ *	register counts words, so lines are rounded up to 16 bits.
+ *
+ *	Returns negative errno on error, or zero on success.
+ */
+static int
+s1d13xxxfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 line_length;
+
+	var->xres = info->var.xres;
+	var->yres = info->var.yres;
+
+	if (var->bits_per_pixel <= 4)
+		var->bits_per_pixel = 4;
+	else if (var->bits_per_pixel <= 8)
+		var->bits_per_pixel = 8;
+	else if (var->bits_per_pixel <= 16)
+		var->bits_per_pixel = 16;
+	else
+		return -EINVAL;
+
+	var->xres_virtual = ALIGN(max(var->xres_virtual, var->xres),
+				  16 / var->bits_per_pixel);
+	var->yres_virtual = max(var->yres_virtual, var->yres);
+
+	line_length = var->xres_virtual * var->bits_per_pixel / 8;
+	if ((line_length >> 1) > 0x7ff)
+		return -EINVAL;
+	if (line_length * var->yres_virtual > par->offscreen_base)
+		return -ENOMEM;
+
+	if (var->xoffset + var->xres > var->xres_virtual ||
+	    var->yoffset + var->yres > var->yres_virtual)
+		return -EINVAL;
+
+	if (var->bits_per_pixel == 16) {
+		var->red.offset = 11;
+		var->red.length = 5;
+		var->green.offset = 5;
+		var->green.length = 6;
+		var->blue.offset = 0;
+		var->blue.length = 5;
+	} else {
+		var->red.offset = var->green.offset = var->blue.offset = 0;
+		var->red.length = var->green.length = var->blue.length = 4;
+	}
+	var->transp.offset = var->transp.length = 0;
+
+	return 0;
+}
+
 /**
  *      s1d13xxxfb_set_par - Alters the hardware state.
  *      @info: frame buffer structure
@@ -208,9 +349,6 @@ s1d13xxxfb_setup_truecolour(struct fb_info *info)
  *	fb_info since we are using that data. This means we depend on the
  *	data in var inside fb_info to be supported by the hardware.
  *	xxxfb_check_var is always called before xxxfb_set_par to ensure this.
- *
- *	XXX TODO: write proper s1d13xxxfb_check_var(), without which that
- *	function is quite useless.
  */
 static int
 s1d13xxxfb_set_par(struct fb_info *info)
@@ -220,6 +358,12 @@ s1d13xxxfb_set_par(struct fb_info *info)
 
 	dbg("s1d13xxxfb_set_par: bpp=%d\n", info->var.bits_per_pixel);
 
+	/* don't change the depth under a running blit */
+	s1d13xxxfb_sync_sleep(info);
+	bltbit_invalidate(s1dfb);
+	/* the solid pattern is in the old pixel format */
+	s1dfb->pattern_solid = 0;
+
 	if ((s1dfb->display & 0x01))	/* LCD */
 		val = s1d13xxxfb_readreg(s1dfb, S1DREG_LCD_DISP_MODE);   /* read colour control */
 	else	/* CRT */
@@ -256,11 +400,33 @@ s1d13xxxfb_set_par(struct fb_info *info)
 	else	/* CRT */
 		s1d13xxxfb_writereg(s1dfb, S1DREG_CRT_DISP_MODE, val);
 
-	info->fix.line_length  = info->var.xres * info->var.bits_per_pixel;
+	info->fix.line_length  = info->var.xres_virtual * info->var.bits_per_pixel;
 	info->fix.line_length /= 8;
 
 	dbg("setting line_length to %d\n", info->fix.line_length);
 
+	/* the line offset in words */
+	val = info->fix.line_length >> 1;
+	if ((s1dfb->display & 0x01)) {	/* LCD */
+		s1d13xxxfb_writereg(s1dfb, S1DREG_LCD_MEM_OFF0, val & 0xff);
+		s1d13xxxfb_writereg(s1dfb, S1DREG_LCD_MEM_OFF1, (val >> 8) & 0x07);
+	} else {	/* CRT */
+		s1d13xxxfb_writereg(s1dfb, S1DREG_CRT_MEM_OFF0, val & 0xff);
+		s1d13xxxfb_writereg(s1dfb, S1DREG_CRT_MEM_OFF1, (val >> 8) & 0x07);
+	}
+
+	/* the start address depends on the layout as well */
+	s1d13xxxfb_pan_display(&info->var, info);
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	/* new layout, VRAM doesn't match the shadow anymore */
+	s1d13xxxfb_shadow_invalidate(info);
+#endif
+#ifdef CONFIG_FB_TILEBLITTING
+	/* the cached glyphs are in the old depth and stride */
+	s1d13xxxfb_glyph_cache_init(info);
+#endif
+
 	dbg("done setup\n");
 
 	return 0;
@@ -283,6 +449,9 @@ s1d13xxxfb_setcolreg(u_int regno, u_int red, u_int green, u_int blue,
 {
 	struct s1d13xxxfb_par *s1dfb = info->par;
 	unsigned int pseudo_val;
+#ifdef CONFIG_FB_TILEBLITTING
+	u32 old;
+#endif
 
 	if (regno >= S1D_PALETTE_SIZE)
 		return -EINVAL;
@@ -307,18 +476,27 @@ s1d13xxxfb_setcolreg(u_int regno, u_int red, u_int green, u_int blue,
 			dbg("s1d13xxxfb_setcolreg: pseudo %d, val %08x\n",
 				    regno, pseudo_val);
 
+#ifdef CONFIG_FB_TILEBLITTING
+			old = ((u32 *)info->pseudo_palette)[regno];
+#endif
 #if defined(CONFIG_PLAT_MAPPI)
 			((u32 *)info->pseudo_palette)[regno] = cpu_to_le16(pseudo_val);
 #else
 			((u32 *)info->pseudo_palette)[regno] = pseudo_val;
 #endif
+#ifdef CONFIG_FB_TILEBLITTING
+			/* cached glyphs hold the expanded pixel values, not the index */
+			if (((u32 *)info->pseudo_palette)[regno] != old)
+				memset(s1dfb->glyph_tag, 0, sizeof(s1dfb->glyph_tag));
+#endif
 
 			break;
 		case FB_VISUAL_PSEUDOCOLOR:
+			/* the LUT takes 4 bits per color in the upper nibble */
 			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_ADDR, regno);
-			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, red);
-			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, green);
-			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, blue);
+			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, red >> 8);
+			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, green >> 8);
+			s1d13xxxfb_writereg(s1dfb, S1DREG_LKUP_DATA, blue >> 8);
 
 			break;
 		default:
@@ -375,14 +553,59 @@ s1d13xxxfb_blank(int blank_mode, struct fb_info *info)
 	return ((blank_mode == FB_BLANK_NORMAL) ? 1 : 0);
 }
 
+/* the display is currently in the vertical non-display period */
+static inline int
+s1d13xxxfb_in_vblank(struct s1d13xxxfb_par *par)
+{
+	u16 reg = (par->display & 0x01) ? S1DREG_LCD_NDISP_VPER : S1DREG_CRT_NDISP_VPER;
+
+	return (s1d13xxxfb_readreg(par, reg) & S1D_VNDP_STATUS) != 0;
+}
+
+/**
+ *	s1d13xxxfb_wait_vblank - waits for the start of the next vertical blank
+ *	@info: frame buffer structure
+ *	@may_sleep: the caller runs in process context without locks held
+ *
+ *	There is no vsync interrupt, so the non-display status is polled.
+ *	A period we are already in doesn't count, it might end before the
+ *	caller is done. The non-display period is short, so we don't sleep,
+ *	but give the CPU away between reads when the caller allows it.
+ *
+ *	Returns negative errno if the display doesn't seem to run.
+ */
+static int
+s1d13xxxfb_wait_vblank(struct fb_info *info, int may_sleep)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	unsigned long timeout = jiffies + msecs_to_jiffies(VSYNC_TIMEOUT_MS);
+	int state;
+
+	for (state = 1; state >= 0; state--) {
+		while (s1d13xxxfb_in_vblank(par) == state) {
+			if (time_after(jiffies, timeout))
+				return -ETIMEDOUT;
+			if (may_sleep)
+				cond_resched();
+			else
+				cpu_relax();
+		}
+	}
+
+	return 0;
+}
+
 /**
  *	s1d13xxxfb_pan_display - Pans the display.
  *	@var: frame buffer variable screen structure
  *	@info: frame buffer structure that represents a single frame buffer
  *
- *	Pan (or wrap, depending on the `vmode' field) the display using the
- *	`yoffset' field of the `var' structure (`xoffset'  not yet supported).
- *	If the values don't fit, return -EINVAL.
+ *	Pan the display using the `xoffset' and `yoffset' fields of the `var'
+ *	structure. The start address counts words, the pixel panning register
+ *	moves by the pixels within one in 4 and 8bpp. With FB_ACTIVATE_VBL
+ *	the registers are written at the start of the vertical non-display
+ *	period, so a page flip doesn't tear. If the values don't fit, return
+ *	-EINVAL.
  *
  *	Returns negative errno on error, or zero on success.
  */
@@ -390,31 +613,265 @@ static int
 s1d13xxxfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
 {
 	struct s1d13xxxfb_par *par = info->par;
-	u32 start;
+	u32 bits = info->var.bits_per_pixel;
+	u32 start, pan;
+	u8 val;
 
-	if (var->xoffset != 0)	/* not yet ... */
+	if (var->xoffset + info->var.xres > info->var.xres_virtual)
 		return -EINVAL;
 
 	if (var->yoffset + info->var.yres > info->var.yres_virtual)
 		return -EINVAL;
 
 	start = (info->fix.line_length >> 1) * var->yoffset;
+	start += (var->xoffset * bits) >> 4;
+	pan = var->xoffset & ((16 / bits) - 1);
+
+	/* fbcon pans from any context */
+	if (var->activate & FB_ACTIVATE_VBL)
+		s1d13xxxfb_wait_vblank(info, 0);
 
 	if ((par->display & 0x01)) {
 		/* LCD */
 		s1d13xxxfb_writereg(par, S1DREG_LCD_DISP_START0, (start & 0xff));
 		s1d13xxxfb_writereg(par, S1DREG_LCD_DISP_START1, ((start >> 8) & 0xff));
 		s1d13xxxfb_writereg(par, S1DREG_LCD_DISP_START2, ((start >> 16) & 0x0f));
+		val = s1d13xxxfb_readreg(par, S1DREG_LCD_PIX_PAN) & ~0x03;
+		s1d13xxxfb_writereg(par, S1DREG_LCD_PIX_PAN, val | pan);
 	} else {
 		/* CRT */
 		s1d13xxxfb_writereg(par, S1DREG_CRT_DISP_START0, (start & 0xff));
 		s1d13xxxfb_writereg(par, S1DREG_CRT_DISP_START1, ((start >> 8) & 0xff));
 		s1d13xxxfb_writereg(par, S1DREG_CRT_DISP_START2, ((start >> 16) & 0x0f));
+		val = s1d13xxxfb_readreg(par, S1DREG_CRT_PIX_PAN) & ~0x03;
+		s1d13xxxfb_writereg(par, S1DREG_CRT_PIX_PAN, val | pan);
+	}
+
+	return 0;
+}
+
+/************************************************************
+ hardware cursor
+ ************************************************************/
+
+/* 2bpp cursor pixel values */
+#define CUR_COLOR0	0
+#define CUR_COLOR1	1
+#define CUR_TRANSP	2
+#define CUR_INVERT	3
+
+/* the CRT/TV cursor registers are the LCD ones plus 0x10 */
+static inline u16
+cursor_reg(struct s1d13xxxfb_par *par, u16 reg)
+{
+	return (par->display & 0x01) ? reg : reg + 0x10;
+}
+
+/**
+ *	cursor_set_mode - switches the Ink/Cursor unit
+ *	@par : driver private data
+ *	@on  : show the cursor
+ *
+ *	Only touches the register when the state changes, fbcon calls us
+ *	on every blink.
+ */
+static void
+cursor_set_mode(struct s1d13xxxfb_par *par, int on)
+{
+	if (par->cursor_on == on)
+		return;
+
+	s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_CTL),
+			on ? S1D_CUR_CTL_CURSOR : S1D_CUR_CTL_OFF);
+	par->cursor_on = on;
+}
+
+/* sign and magnitude, the hotspot may push the cursor past the top left */
+static inline u16
+cursor_pos(int pos)
+{
+	return (pos < 0) ? (0x8000 | (-pos & 0x3ff)) : (pos & 0x3ff);
+}
+
+/**
+ *	cursor_set_rgb - programs one of the two cursor/ink colors
+ *	@par : driver private data
+ *	@reg : S1DREG_LCD_CUR_BCTL0 or S1DREG_LCD_CUR_BCTL1
+ *	@rgb : RGB565
+ */
+static void
+cursor_set_rgb(struct s1d13xxxfb_par *par, u16 reg, u16 rgb)
+{
+	reg = cursor_reg(par, reg);
+	s1d13xxxfb_writereg(par, reg, rgb & 0x1f);
+	s1d13xxxfb_writereg(par, reg + 1, (rgb >> 5) & 0x3f);
+	s1d13xxxfb_writereg(par, reg + 2, (rgb >> 11) & 0x1f);
+}
+
+/**
+ *	cursor_build_image - converts the fbcon cursor into the 2bpp format
+ *	@info   : frambuffer structure
+ *	@cursor : cursor description, image and mask are 1bpp
+ *
+ *	Everything outside the mask is transparent. With ROP_XOR the mask
+ *	inverts the pixels below, so the image doesn't depend on the glyph
+ *	under the cursor and a move doesn't need a new upload.
+ */
+static void
+cursor_build_image(struct fb_info *info, const struct fb_cursor *cursor)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	const u8 *mask = (const u8 *)cursor->mask;
+	const u8 *data = (const u8 *)cursor->image.data;
+	u32 pitch = (cursor->image.width + 7) >> 3;
+	int hi_first = fb_be_math(info);
+	u8 *dst = par->cursor_build;
+	int x, y;
+
+	/* 0xaa is four transparent pixels */
+	memset(dst, 0xaa, S1D_CURSOR_SIZE);
+
+	for (y = 0; y < cursor->image.height; y++) {
+		u8 *line = dst + y * (S1D_CURSOR_WIDTH / 4);
+
+		for (x = 0; x < cursor->image.width; x++) {
+			u32 off = y * pitch + (x >> 3);
+			u8 bit = 0x80 >> (x & 7);
+			int shift = (x & 3) << 1;
+			u8 pix;
+
+			if (!(mask[off] & bit))
+				continue;
+
+			if (cursor->rop == ROP_XOR)
+				pix = CUR_INVERT;
+			else
+				pix = (data[off] & bit) ? CUR_COLOR1 : CUR_COLOR0;
+
+			if (hi_first)
+				shift = 6 - shift;
+			line[x >> 2] = (line[x >> 2] & ~(3 << shift)) | (pix << shift);
+		}
+	}
+}
+
+/**
+ *	__s1d13xxxfb_cursor - fb_cursor on the Ink/Cursor unit
+ *	@info   : frambuffer structure
+ *	@cursor : what changed and the new state
+ *
+ *	A move is two register writes. The shape is only copied to VRAM
+ *	when it differs from what is already there. Returning an error makes
+ *	fbcon fall back to the software cursor. Called with the cursor lock
+ *	held.
+ */
+static int
+__s1d13xxxfb_cursor(struct fb_info *info, struct fb_cursor *cursor)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 *pal = info->pseudo_palette;
+	u16 set;
+	int x, y;
+
+	/* the ink layer owns the unit */
+	if (par->ink_on) {
+		par->cursor_pending |= cursor->set;
+		return -EINVAL;
+	}
+
+	/* the colors are RGB, in palette modes only XOR works */
+	if (cursor->image.width > S1D_CURSOR_WIDTH ||
+	    cursor->image.height > S1D_CURSOR_HEIGHT ||
+	    cursor->image.depth > 1 ||
+	    (cursor->rop != ROP_XOR && info->fix.visual != FB_VISUAL_TRUECOLOR)) {
+		/* the software cursor takes over */
+		par->cursor_pending |= cursor->set;
+		cursor_set_mode(par, 0);
+		return -EINVAL;
+	}
+
+	/* changes made while hidden are applied when it shows up again */
+	if (!cursor->enable) {
+		par->cursor_pending |= cursor->set;
+		cursor_set_mode(par, 0);
+		return 0;
+	}
+	set = cursor->set | par->cursor_pending;
+	par->cursor_pending = 0;
+
+	/* fbcon passes the full shape on every call */
+	if (!par->cursor_valid ||
+	    (set & (FB_CUR_SETSHAPE | FB_CUR_SETIMAGE | FB_CUR_SETSIZE))) {
+		cursor_build_image(info, cursor);
+		if (!par->cursor_valid ||
+		    memcmp(par->cursor_build, par->cursor_image, S1D_CURSOR_SIZE)) {
+			/* the engine may be writing VRAM as well */
+			s1d13xxxfb_sync(info);
+			memcpy_toio(par->vram + par->vram_size - S1D_CURSOR_SIZE,
+					par->cursor_build, S1D_CURSOR_SIZE);
+			memcpy(par->cursor_image, par->cursor_build, S1D_CURSOR_SIZE);
+			par->cursor_valid = 1;
+		}
+	}
+
+	if ((set & FB_CUR_SETCMAP) && cursor->rop != ROP_XOR) {
+		cursor_set_rgb(par, S1DREG_LCD_CUR_BCTL0, pal[cursor->image.bg_color & 15]);
+		cursor_set_rgb(par, S1DREG_LCD_CUR_BCTL1, pal[cursor->image.fg_color & 15]);
+	}
+
+	if (set & (FB_CUR_SETPOS | FB_CUR_SETHOT)) {
+		/* the position is relative to the visible screen */
+		x = cursor->image.dx - cursor->hot.x - info->var.xoffset;
+		y = cursor->image.dy - cursor->hot.y - info->var.yoffset;
+		s1d13xxxfb_writeregw(par, cursor_reg(par, S1DREG_LCD_CUR_XPOS0), cursor_pos(x));
+		s1d13xxxfb_writeregw(par, cursor_reg(par, S1DREG_LCD_CUR_YPOS0), cursor_pos(y));
 	}
 
+	cursor_set_mode(par, 1);
 	return 0;
 }
 
+static int
+s1d13xxxfb_cursor(struct fb_info *info, struct fb_cursor *cursor)
+{
+	int ret;
+
+	spin_lock(&s1d13xxxfb_cursor_lock);
+	ret = __s1d13xxxfb_cursor(info, cursor);
+	spin_unlock(&s1d13xxxfb_cursor_lock);
+
+	return ret;
+}
+
+/**
+ *	s1d13xxxfb_inkcursor_init - reserves the top of VRAM for the Ink/Cursor unit
+ *	@info : frambuffer structure
+ *
+ *	Start address 0 selects the last S1D_CURSOR_SIZE bytes of the
+ *	display buffer for the cursor, start address n the last n * 8K for
+ *	the ink layer. smem_len is lowered so that mmap and the virtual
+ *	resolution stay clear of both. Needs the mode from fetch_hw_state.
+ */
+static void
+s1d13xxxfb_inkcursor_init(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 reserve = PAGE_ALIGN(S1D_CURSOR_SIZE);
+
+	if (ink) {
+		par->ink_size = roundup(info->var.xres * info->var.yres / 4, 8192);
+		reserve = max(reserve, par->ink_size);
+	}
+
+	info->fix.smem_len = par->vram_size - reserve;
+	info->var.yres_virtual = info->fix.smem_len / info->fix.line_length;
+
+	s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_CTL), S1D_CUR_CTL_OFF);
+	s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_START), 0);
+	par->cursor_on = 0;
+	par->cursor_valid = 0;
+}
+
 /************************************************************
  functions to handle bitblt acceleration
  ************************************************************/
@@ -447,107 +904,573 @@ bltbit_wait_bitset(struct fb_info *info, u8 bit)
 	while ((s1d13xxxfb_readreg(info->par, S1DREG_BBLT_CTL0) & bit)==0);
 }
 
-/*
- *	s1d13xxxfb_bitblt_copyarea - accelerated copyarea function
- *	@info : framebuffer structure
- *	@area : fb_copyarea structure
+/**
+ *	bltbit_setreg - writes a bitblt register unless it already has the value
+ *	@par   : driver data
+ *	@regno : register between S1DREG_BBLT_CTL0 and S1DREG_BBLT_FGC1
+ *	@value : new value
  *
- *	supports (atleast) S1D13506
+ *	most of the bitblt setup (stride, bpp, operation) doesn't change
+ *	between two blits, so we keep a copy of what the engine has and
+ *	skip the slow bus cycle
  *
  */
-static void
-s1d13xxxfb_bitblt_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+static inline void
+bltbit_setreg(struct s1d13xxxfb_par *par, u16 regno, u8 value)
 {
-	u32 dst, src;
-	u32 stride;
-	u16 reverse = 0;
-	u16 sx = area->sx, sy = area->sy;
-	u16 dx = area->dx, dy = area->dy;
-	u16 width = area->width, height = area->height;
-	u16 bpp;
+	unsigned int i = regno - S1DREG_BBLT_CTL0;
+	struct s1d13xxxfb_blt_stats *stats = &par->blt_stats[par->blt_op];
 
-        if (info->state != FBINFO_STATE_RUNNING) return;
-
-	// Call SW impl if acceleration is disabled
-	if (info->flags & FBINFO_HWACCEL_DISABLED) {
-		cfb_copyarea(info, area);
+	if ((par->blt_valid & (1 << i)) && par->blt_shadow[i] == value) {
+		stats->saved++;
 		return;
 	}
 
-	/* bytes per xres line */
-	bpp = (info->var.bits_per_pixel >> 3);
-	stride = bpp * info->var.xres;
+	s1d13xxxfb_writereg(par, regno, value);
+	par->blt_shadow[i] = value;
+	par->blt_valid |= 1 << i;
+	stats->writes++;
+}
 
-	/* reverse, calculate the last pixel in rectangle */
-	if ((dy > sy) || ((dy == sy) && (dx >= sx))) {
-		dst = (((dy + height - 1) * stride) + (bpp * (dx + width - 1)));
-		src = (((sy + height - 1) * stride) + (bpp * (sx + width - 1)));
-		reverse = 1;
-	/* not reverse, calculate the first pixel in rectangle */
-	} else { /* (y * xres) + (bpp * x) */
-		dst = (dy * stride) + (bpp * dx);
-		src = (sy * stride) + (bpp * sx);
+/**
+ *	bltbit_setregw - writes an even/odd pair of bitblt registers
+ *	@par   : driver data
+ *	@regno : even register, gets the low byte
+ *	@value : new value
+ *
+ *	uses a single 16bit cycle if both bytes changed
+ *
+ */
+static inline void
+bltbit_setregw(struct s1d13xxxfb_par *par, u16 regno, u16 value)
+{
+	unsigned int i = regno - S1DREG_BBLT_CTL0;
+	struct s1d13xxxfb_blt_stats *stats = &par->blt_stats[par->blt_op];
+	int lo_ok = (par->blt_valid & (1 << i)) && par->blt_shadow[i] == (value & 0xff);
+	int hi_ok = (par->blt_valid & (2 << i)) && par->blt_shadow[i + 1] == (value >> 8);
+
+	if (lo_ok || hi_ok) {
+		bltbit_setreg(par, regno, value & 0xff);
+		bltbit_setreg(par, regno + 1, value >> 8);
+		return;
 	}
 
-	/* wait for engine to be free */
-	spin_lock(&s1d13xxxfb_bitblt_lock);
+	s1d13xxxfb_writeregw(par, regno, value);
+	par->blt_shadow[i] = value & 0xff;
+	par->blt_shadow[i + 1] = value >> 8;
+	par->blt_valid |= 3 << i;
+	stats->writes++;
+	stats->saved++;
+}
 
-	/* set source address */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_SRC_START0, (src & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_SRC_START1, (src >> 8) & 0x00ff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_SRC_START2, (src >> 16) & 0x00ff);
+/* 24bit start address, low word + high byte */
+static inline void
+bltbit_set_addr(struct s1d13xxxfb_par *par, u16 regno, u32 addr)
+{
+	bltbit_setregw(par, regno, addr & 0xffff);
+	bltbit_setreg(par, regno + 2, (addr >> 16) & 0xff);
+}
 
-	/* set destination address */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START0, (dst & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START1, (dst >> 8) & 0x00ff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START2, (dst >> 16) & 0x00ff);
+/* operation and ROP code share a word */
+static inline void
+bltbit_set_op(struct s1d13xxxfb_par *par, u8 op, u8 rop)
+{
+	bltbit_setregw(par, S1DREG_BBLT_CC_EXP, (op << 8) | rop);
+}
 
-	/* program height and width */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH0, (width & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH1, (width >> 8));
+/* forget the shadow, after the registers were changed behind our back */
+static void
+bltbit_invalidate(struct s1d13xxxfb_par *par)
+{
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	par->blt_valid = 0;
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
 
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT0, (height & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT1, (height >> 8));
+/**
+ *	bltbit_wait_idle - waits for the previous blit to finish
+ *	@info : frambuffer structure
+ *
+ *	blits don't wait for the engine when they are done, so this is
+ *	called with the bitblt lock held before the registers are
+ *	programmed for the next one
+ *
+ */
+static inline void
+bltbit_wait_idle(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
 
-	/* negative direction ROP */
-	if (reverse == 1) {
-		dbg_blit("(copyarea) negative rop\n");
-		s1d13xxxfb_writereg(info->par, S1DREG_BBLT_OP, 0x03);
-	} else /* positive direction ROP */ {
-		s1d13xxxfb_writereg(info->par, S1DREG_BBLT_OP, 0x02);
-		dbg_blit("(copyarea) positive rop\n");
-	}
+	if (!par->blt_busy)
+		return;
 
-	/* set for rectangel mode and not linear */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x0);
+	bltbit_wait_bitclear(info, BBLT_ACTIVE);
+	par->blt_busy = 0;
+}
 
-	/* setup the bpp 1 = 16bpp, 0 = 8bpp*/
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+/**
+ *	bltbit_begin - gets the engine ready for programming
+ *	@info : frambuffer structure
+ *	@op   : S1D_BLT_xxx, selects the statistics the register writes go to
+ *
+ *	called with the bitblt lock held
+ *
+ */
+static inline void
+bltbit_begin(struct fb_info *info, int op)
+{
+	struct s1d13xxxfb_par *par = info->par;
 
-	/* set words per xres */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF0, (stride >> 1) & 0xff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF1, (stride >> 9));
+	bltbit_wait_idle(info);
+	par->blt_op = op;
+}
 
-	dbg_blit("(copyarea) dx=%d, dy=%d\n", dx, dy);
-	dbg_blit("(copyarea) sx=%d, sy=%d\n", sx, sy);
-	dbg_blit("(copyarea) width=%d, height=%d\n", width - 1, height - 1);
-	dbg_blit("(copyarea) stride=%d\n", stride);
-	dbg_blit("(copyarea) bpp=%d=0x0%d, mem_offset1=%d, mem_offset2=%d\n", bpp, (bpp >> 1), (stride >> 1) & 0xff, stride >> 9);
+/**
+ *	bltbit_start_ctl - kicks off the programmed blit
+ *	@info : frambuffer structure
+ *	@ctl  : BBLT_DST_LINEAR / BBLT_SRC_LINEAR, 0 for rectangles
+ *
+ *	the engine is marked busy until bltbit_wait_idle() or
+ *	s1d13xxxfb_sync() saw it finish
+ *
+ */
+static inline void
+bltbit_start_ctl(struct fb_info *info, u8 ctl)
+{
+	struct s1d13xxxfb_par *par = info->par;
 
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CC_EXP, 0x0c);
+	s1d13xxxfb_writereg(par, S1DREG_BBLT_CTL0, BBLT_ACTIVE | ctl);
+	par->blt_busy = 1;
 
-	/* initialize the engine */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x80);
+	par->blt_stats[par->blt_op].calls++;
+	par->blt_stats[par->blt_op].writes++;
+}
 
-	/* Wait to complete */
-	bltbit_wait_bitclear(info, 0x80);
-	spin_unlock(&s1d13xxxfb_bitblt_lock);
+/* rectangle blit, clears the linear select bits */
+static inline void
+bltbit_start(struct fb_info *info)
+{
+	bltbit_start_ctl(info, 0);
 }
 
+/* no color key for the transparent blits */
+#define BBLT_NO_KEY	(-1)
+
 /**
+ *	bltbit_set_size - programs the rectangle size
+ *	@info   : frambuffer structure
+ *	@width  : width in pixels
+ *	@height : height in lines
  *
- *	s1d13xxxfb_bitblt_solidfill - accelerated solidfill function
- *	@info : framebuffer structure
+ *	the engine takes (n - 1) for both, split over two registers
+ *
+ */
+static inline void
+bltbit_set_size(struct fb_info *info, u16 width, u16 height)
+{
+	bltbit_setregw(info->par, S1DREG_BBLT_WIDTH0, width - 1);
+	bltbit_setregw(info->par, S1DREG_BBLT_HEIGHT0, height - 1);
+}
+
+/*
+ * The engine only knows 8 and 16bpp. 4bpp is run at 8bpp with two pixels
+ * per byte, so x and width have to be even there and are halved by the
+ * callers; everything below works in these engine pixels.
+ */
+static inline u16
+bltbit_bytespp(struct fb_info *info)
+{
+	return (info->var.bits_per_pixel + 7) >> 3;
+}
+
+/* bytes per line of the virtual screen */
+static inline u32
+bltbit_stride(struct fb_info *info)
+{
+	return info->fix.line_length;
+}
+
+/* two 4bpp pixels in a byte, in the order cfb_* uses */
+static inline u8
+bltbit_pack4(int hi_first, u8 left, u8 right)
+{
+	if (hi_first)
+		return (left << 4) | right;
+	return (right << 4) | left;
+}
+
+/**
+ *	bltbit_fifo_credit - waits for room in the BitBLT FIFO
+ *	@info : frambuffer structure
+ *
+ *	returns the number of words that can be written to the FIFO
+ *	before the status has to be checked again:
+ *
+ *	not empty | half full | full
+ *	    0           0         0    --> 16 words
+ *	    1           0         0    --> 8 words
+ *	    1           1         0    --> 1 word
+ *	    1           1         1    --> wait
+ *
+ */
+static inline int
+bltbit_fifo_credit(struct fb_info *info)
+{
+	u8 status;
+
+	do {
+		status = s1d13xxxfb_readreg(info->par, S1DREG_BBLT_CTL0);
+	} while (status & BBLT_FIFO_FULL);
+
+	if (!(status & BBLT_FIFO_NOT_EMPTY))
+		return 16;
+	if (!(status & BBLT_FIFO_HALF_FULL))
+		return 8;
+	return 1;
+}
+
+/**
+ *	s1d13xxxfb_sync - waits for the bitblt engine to become idle
+ *	@info : framebuffer structure
+ *
+ *	called by the fb core before the CPU touches VRAM, and by us
+ *	before the software fallbacks. Callers may hold spinlocks or run
+ *	with interrupts off, so this never sleeps.
+ */
+static int
+s1d13xxxfb_sync(struct fb_info *info)
+{
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	bltbit_wait_idle(info);
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+
+	return 0;
+}
+
+/**
+ *	s1d13xxxfb_sync_sleep - waits for the bitblt engine, sleeping
+ *	@info : framebuffer structure
+ *
+ *	for the ioctls and set_par, where a long blit may be outstanding.
+ *	Must not be called from the fbcon drawing paths.
+ *
+ *	Returns negative errno if the engine doesn't finish.
+ */
+static int
+s1d13xxxfb_sync_sleep(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	unsigned long timeout = jiffies + msecs_to_jiffies(BBLT_SYNC_TIMEOUT_MS);
+	int spins = BBLT_SYNC_SPINS;
+
+	might_sleep();
+
+	while (s1d13xxxfb_readreg(par, S1DREG_BBLT_CTL0) & BBLT_ACTIVE) {
+		if (spins) {
+			spins--;
+			cpu_relax();
+			continue;
+		}
+		if (time_after(jiffies, timeout)) {
+			printk(KERN_ERR PFX "bitblt engine timed out\n");
+			return -ETIMEDOUT;
+		}
+		usleep_range(50, 200);
+	}
+
+	/* a blit started meanwhile is short, and blt_busy is cleared under the lock */
+	return s1d13xxxfb_sync(info);
+}
+
+/**
+ *	bltbit_move - screen to screen blit
+ *	@info    : framebuffer structure
+ *	@sx, @sy : source, in engine pixels
+ *	@dx, @dy : destination, in engine pixels
+ *	@width   : engine pixels
+ *	@height  : lines
+ *	@rop     : BBLT_ROP_xxx
+ *	@key     : color key of a transparent move, or BBLT_NO_KEY
+ *
+ *	Overlapping areas where the destination is below or right of the
+ *	source are moved backwards, the engine has no transparent move in
+ *	that direction.
+ *
+ *	Returns -EOPNOTSUPP if the engine can't do it, or zero on success.
+ */
+static int
+bltbit_move(struct fb_info *info, u32 sx, u32 sy, u32 dx, u32 dy,
+		u32 width, u32 height, u8 rop, int key)
+{
+	u32 dst, src;
+	u32 stride;
+	u16 reverse = 0;
+	u16 bpp;
+
+	/* bytes per line */
+	bpp = bltbit_bytespp(info);
+	stride = bltbit_stride(info);
+
+	/* reverse, calculate the last pixel in rectangle */
+	if ((dy > sy) || ((dy == sy) && (dx >= sx))) {
+		dst = (((dy + height - 1) * stride) + (bpp * (dx + width - 1)));
+		src = (((sy + height - 1) * stride) + (bpp * (sx + width - 1)));
+		reverse = 1;
+	/* not reverse, calculate the first pixel in rectangle */
+	} else { /* (y * xres) + (bpp * x) */
+		dst = (dy * stride) + (bpp * dx);
+		src = (sy * stride) + (bpp * sx);
+	}
+
+	/* a transparent move only goes forward, fine if the areas don't overlap */
+	if (key != BBLT_NO_KEY && reverse) {
+		if (dy < sy + height && sy < dy + height &&
+		    dx < sx + width && sx < dx + width)
+			return -EOPNOTSUPP;
+		dst = (dy * stride) + (bpp * dx);
+		src = (sy * stride) + (bpp * sx);
+		reverse = 0;
+	}
+
+	/* wait for engine to be free */
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	bltbit_begin(info, S1D_BLT_COPY);
+
+	/* set source address */
+	bltbit_set_addr(info->par, S1DREG_BBLT_SRC_START0, src);
+
+	/* set destination address */
+	bltbit_set_addr(info->par, S1DREG_BBLT_DST_START0, dst);
+
+	/* program height and width */
+	bltbit_set_size(info, width, height);
+
+	if (key != BBLT_NO_KEY) {
+		/* the key goes to the background color, no ROP */
+		bltbit_setregw(info->par, S1DREG_BBLT_BGC0, key & 0xffff);
+		bltbit_set_op(info->par, BBLT_MOVE_TRANSP, BBLT_ROP_COPY);
+	} else if (reverse == 1) {
+		/* negative direction */
+		dbg_blit("(copyarea) negative rop\n");
+		bltbit_set_op(info->par, BBLT_MOVE_NEG, rop);
+	} else /* positive direction */ {
+		bltbit_set_op(info->par, BBLT_MOVE_POS, rop);
+		dbg_blit("(copyarea) positive rop\n");
+	}
+
+	/* setup the bpp 1 = 16bpp, 0 = 8bpp*/
+	bltbit_setreg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+
+	/* set words per xres */
+	bltbit_setregw(info->par, S1DREG_BBLT_MEM_OFF0, stride >> 1);
+
+	dbg_blit("(copyarea) dx=%d, dy=%d\n", dx, dy);
+	dbg_blit("(copyarea) sx=%d, sy=%d\n", sx, sy);
+	dbg_blit("(copyarea) width=%d, height=%d\n", width - 1, height - 1);
+	dbg_blit("(copyarea) stride=%d\n", stride);
+	dbg_blit("(copyarea) bpp=%d=0x0%d, mem_offset1=%d, mem_offset2=%d\n", bpp, (bpp >> 1), (stride >> 1) & 0xff, stride >> 9);
+
+	/* initialize the engine */
+	bltbit_start(info);
+
+	/* don't wait for the blit, the next one or fb_sync will */
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+	return 0;
+}
+
+/*
+ *	s1d13xxxfb_bitblt_copyarea - accelerated copyarea function
+ *	@info : framebuffer structure
+ *	@area : fb_copyarea structure
+ *
+ *	supports (atleast) S1D13506
+ *
+ */
+static void
+s1d13xxxfb_bitblt_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	u32 sx = area->sx, dx = area->dx, width = area->width;
+
+        if (info->state != FBINFO_STATE_RUNNING) return;
+
+	if (!width || !area->height)
+		return;
+
+	// Call SW impl if acceleration is disabled, in 4bpp only whole bytes can be moved
+	if ((info->flags & FBINFO_HWACCEL_DISABLED) ||
+	    (info->var.bits_per_pixel == 4 && ((sx | dx | width) & 1))) {
+		s1d13xxxfb_sync(info);
+		cfb_copyarea(info, area);
+		return;
+	}
+
+	if (info->var.bits_per_pixel == 4) {
+		sx >>= 1;
+		dx >>= 1;
+		width >>= 1;
+	}
+
+	bltbit_move(info, sx, area->sy, dx, area->dy, width, area->height,
+			BBLT_ROP_COPY, BBLT_NO_KEY);
+}
+
+/* programs and starts a solid fill, called with the bitblt lock held */
+static void
+__bltbit_fill(struct fb_info *info, u32 dest, u16 width, u16 height, u32 stride,
+		u32 color, u16 bpp, u8 ctl)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	bltbit_begin(info, S1D_BLT_FILL);
+
+	/* We split the destination into the three registers */
+	bltbit_set_addr(par, S1DREG_BBLT_DST_START0, dest);
+
+	/* give information regarding rectangel width and height */
+	bltbit_set_size(info, width, height);
+
+	/* set foreground color */
+	bltbit_setregw(par, S1DREG_BBLT_FGC0, color & 0xffff);
+
+	/* set operation mode SOLID_FILL, the ROP code is not used */
+	bltbit_setreg(par, S1DREG_BBLT_OP, BBLT_SOLID_FILL);
+
+	/* set bits per pixel (1 = 16bpp, 0 = 8bpp) */
+	bltbit_setreg(par, S1DREG_BBLT_CTL1, (bpp >> 1));
+
+	/* set the memory offset for the bblt in word sizes */
+	bltbit_setregw(par, S1DREG_BBLT_MEM_OFF0, stride >> 1);
+
+	/* and away we go.... */
+	bltbit_start_ctl(info, ctl);
+}
+
+/**
+ *	bltbit_fill - solid fill of a rectangle anywhere in VRAM
+ *	@info   : framebuffer structure
+ *	@dest   : VRAM offset
+ *	@width  : engine pixels per line
+ *	@height : lines
+ *	@stride : bytes between lines, even
+ *	@color  : pixel value
+ *	@bpp    : bytes per engine pixel, 1 or 2
+ *
+ *	Doesn't wait for the blit to finish.
+ */
+static void
+bltbit_fill(struct fb_info *info, u32 dest, u16 width, u16 height, u32 stride,
+		u32 color, u16 bpp)
+{
+	/* wait for engine to be free */
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	__bltbit_fill(info, dest, width, height, stride, color, bpp, 0);
+
+	/* let others play */
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+/**
+ *	bltbit_fill_linear - solid fill of a contiguous range of VRAM
+ *	@info  : framebuffer structure
+ *	@dest  : VRAM offset, even
+ *	@bytes : length, even
+ *	@color : 16bit pattern, e.g. an 8bpp pixel value in both bytes
+ *
+ *	The linear mode ignores the line offset, so whole screens and
+ *	offscreen ranges are filled without the rectangle limits: the
+ *	range is run at 16bpp in pieces of up to 1024 x 1024 pixels.
+ *	Doesn't wait for the last piece to finish.
+ */
+static void
+bltbit_fill_linear(struct fb_info *info, u32 dest, u32 bytes, u16 color)
+{
+	u32 words = bytes >> 1;
+	u32 width, height;
+
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	while (words) {
+		if (words >= 1024) {
+			width = 1024;
+			height = min_t(u32, words >> 10, 1024);
+		} else {
+			width = words;
+			height = 1;
+		}
+		__bltbit_fill(info, dest, width, height, width << 1, color, 2,
+				BBLT_DST_LINEAR);
+		dest += (width * height) << 1;
+		words -= width * height;
+	}
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+/**
+ *	bltbit_pattern - pattern fill blit
+ *	@info    : framebuffer structure
+ *	@dx, @dy : destination, in engine pixels
+ *	@width   : engine pixels
+ *	@height  : lines
+ *	@pattern : 8x8 engine pixels, or NULL for a solid pattern of @color
+ *	@color   : pixel value of the solid pattern
+ *	@rop     : BBLT_ROP_xxx, the pattern is the source
+ *	@key     : color key of a transparent fill, or BBLT_NO_KEY
+ *
+ *	The pattern lives in one slot of offscreen VRAM and is anchored to
+ *	the screen, pixel (x, y) gets pattern pixel (x & 7, y & 7). It is
+ *	rewritten by the CPU once the engine is idle; a solid color that is
+ *	already there is kept.
+ */
+static void
+bltbit_pattern(struct fb_info *info, u32 dx, u32 dy, u32 width, u32 height,
+		const u8 *pattern, u32 color, u8 rop, int key)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	void __iomem *slot = par->vram + par->pattern_offset;
+	u16 bpp = bltbit_bytespp(info);
+	u32 stride = bltbit_stride(info);
+	u32 src = par->pattern_offset + ((dy & 7) * 8 + (dx & 7)) * bpp;
+	int i;
+
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	bltbit_begin(info, S1D_BLT_PATTERN);
+
+	if (pattern) {
+		memcpy_toio(slot, pattern, 64 * bpp);
+		par->pattern_solid = 0;
+	} else if (!par->pattern_solid || par->pattern_color != color) {
+		for (i = 0; i < 64; i++) {
+			if (bpp == 2)
+				writew(color, slot + (i << 1));
+			else
+				writeb(color, slot + i);
+		}
+		par->pattern_color = color;
+		par->pattern_solid = 1;
+	}
+
+	/* the source selects the pattern pixel of the first destination pixel */
+	bltbit_set_addr(par, S1DREG_BBLT_SRC_START0, src);
+	bltbit_set_addr(par, S1DREG_BBLT_DST_START0, dy * stride + dx * bpp);
+	bltbit_set_size(info, width, height);
+
+	if (key != BBLT_NO_KEY) {
+		bltbit_setregw(par, S1DREG_BBLT_BGC0, key & 0xffff);
+		bltbit_set_op(par, BBLT_PATTERN_TRANSP, BBLT_ROP_COPY);
+	} else {
+		bltbit_set_op(par, BBLT_PATTERN, rop);
+	}
+
+	bltbit_setreg(par, S1DREG_BBLT_CTL1, (bpp >> 1));
+	bltbit_setregw(par, S1DREG_BBLT_MEM_OFF0, stride >> 1);
+	bltbit_start(info);
+
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+/**
+ *
+ *	s1d13xxxfb_bitblt_solidfill - accelerated solidfill function
+ *	@info : framebuffer structure
  *	@rect : fb_fillrect structure
  *
  *	supports (atleast 13506)
@@ -556,395 +1479,1924 @@ s1d13xxxfb_bitblt_copyarea(struct fb_info *info, const struct fb_copyarea *area)
 static void
 s1d13xxxfb_bitblt_solidfill(struct fb_info *info, const struct fb_fillrect *rect)
 {
+	struct s1d13xxxfb_par *par = info->par;
 	u32 screen_stride, dest;
 	u32 fg;
-	u16 bpp = (info->var.bits_per_pixel >> 3);
+	u16 bpp = bltbit_bytespp(info);
+	u32 dx = rect->dx, width = rect->width;
+	struct fb_fillrect edge;
 
         if (info->state != FBINFO_STATE_RUNNING)
         return;
 
-	// Call SW impl if acceleration is disabled
-	if (info->flags & FBINFO_HWACCEL_DISABLED) {
+	if (!rect->width || !rect->height)
+		return;
+
+	// Call SW impl if acceleration is disabled, XOR needs the pattern slot
+	if ((info->flags & FBINFO_HWACCEL_DISABLED) ||
+	    (rect->rop != ROP_COPY &&
+	     (rect->rop != ROP_XOR || !par->pattern_offset))) {
+		s1d13xxxfb_sync(info);
 		cfb_fillrect(info, rect);
 		return;
 	}
 
-	/* bytes per x width */
-	screen_stride = (bpp * info->var.xres);
-
-	/* bytes to starting point */
-	dest = ((rect->dy * screen_stride) + (bpp * rect->dx));
+	/* 4bpp: odd columns at the edges in software, the rest in bytes */
+	if (info->var.bits_per_pixel == 4) {
+		edge = *rect;
+		edge.width = 1;
+		if ((dx | width) & 1)
+			s1d13xxxfb_sync(info);
+		if (dx & 1) {
+			cfb_fillrect(info, &edge);
+			dx++;
+			width--;
+		}
+		if (width & 1) {
+			edge.dx = dx + width - 1;
+			cfb_fillrect(info, &edge);
+			width--;
+		}
+		if (!width)
+			return;
+		dx >>= 1;
+		width >>= 1;
+	}
+
+	/* bytes per x width */
+	screen_stride = bltbit_stride(info);
+
+	/* bytes to starting point */
+	dest = ((rect->dy * screen_stride) + (bpp * dx));
+
+	dbg_blit("(solidfill) dx=%d, dy=%d, stride=%d, dest=%d\n"
+		 "(solidfill) : rect_width=%d, rect_height=%d\n",
+				rect->dx, rect->dy, screen_stride, dest,
+				rect->width - 1, rect->height - 1);
+
+	dbg_blit("(solidfill) : xres=%d, yres=%d, bpp=%d\n",
+				info->var.xres, info->var.yres,
+				info->var.bits_per_pixel);
+	dbg_blit("(solidfill) : rop=%d\n", rect->rop);
+
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
+		info->fix.visual == FB_VISUAL_DIRECTCOLOR) {
+		fg = ((u32 *)info->pseudo_palette)[rect->color];
+		dbg_blit("(solidfill) truecolor/directcolor\n");
+		dbg_blit("(solidfill) pseudo_palette[%d] = %d\n", rect->color, fg);
+	} else if (info->var.bits_per_pixel == 4) {
+		fg = rect->color & 0x0f;
+		fg |= fg << 4;
+		dbg_blit("(solidfill) color = %d\n", rect->color);
+	} else {
+		fg = rect->color;
+		dbg_blit("(solidfill) color = %d\n", rect->color);
+	}
+
+	/* XOR: the engine's solid fill has no ROP, a solid pattern has */
+	if (rect->rop == ROP_XOR) {
+		bltbit_pattern(info, dx, rect->dy, width, rect->height,
+				NULL, fg, BBLT_ROP_XOR, BBLT_NO_KEY);
+		return;
+	}
+
+	/* whole lines, e.g. clearing the screen: one linear range */
+	if (width * bpp == screen_stride) {
+		if (bpp == 1)
+			fg |= fg << 8;
+		bltbit_fill_linear(info, dest, rect->height * screen_stride, fg);
+		return;
+	}
+
+	/* don't wait for the blit, the next one or fb_sync will */
+	bltbit_fill(info, dest, width, rect->height, screen_stride, fg, bpp);
+}
+
+/*
+struct fb_image {
+    __u32 dx;       Where to place image 
+    __u32 dy;
+    __u32 width;        Size of image
+    __u32 height;
+    __u32 fg_color;     Only used when a mono bitmap
+    __u32 bg_color;
+    __u8  depth;        Depth of the image
+    const char *data;   Pointer to image data
+    struct fb_cmap cmap;    color map info 
+};
+*/
+/**
+ *	s1d13xxxfb_bitblt_expand_words - FIFO words per line of a color expand blit
+ *	@width : width in pixels
+ *	@phase : source phase, 0 = line starts in the low byte, 1 = high byte
+ *
+ *	The engine takes the first pixel from bit 7 of the byte selected by
+ *	the source phase and expands MSB first, low byte before high byte.
+ *	Every line starts in a new word.
+ */
+static inline u32
+s1d13xxxfb_bitblt_expand_words(u16 width, u8 phase)
+{
+	return ((phase << 3) + width + 15) >> 4;
+}
+
+/**
+ *	bltbit_expand - color expand blit of a 1bpp bitmap, 8 and 16bpp
+ *	@info    : framebuffer structure
+ *	@dx, @dy : destination
+ *	@width   : pixels
+ *	@height  : lines
+ *	@src     : bitmap, MSB first
+ *	@pitch   : bytes from one bitmap line to the next
+ *	@fgcolor : pixel value for set bits
+ *	@bgcolor : pixel value for clear bits
+ *	@transparent : leave the pixels of clear bits alone
+ */
+static void
+bltbit_expand(struct fb_info *info, u16 dx, u16 dy, u16 width, u16 height,
+		const u8 *src, u32 pitch, u32 fgcolor, u32 bgcolor, int transparent)
+{
+	u32 dst, lwords;
+	u32 stride;
+	u16 bpp, data;
+	u16 x, h;
+	u32 lbytes = (width + 7) >> 3;
+	int credit = 0;
+
+	/* bytes per line */
+	bpp = bltbit_bytespp(info);
+	stride = bltbit_stride(info);
+
+	/* 1) Calculate destination address in screen memory */
+	dst = ((dy * stride) + (bpp * dx));
+
+	/* wait for engine to be free */
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	bltbit_begin(info, S1D_BLT_EXPAND);
+
+	/* 2) set destination address */
+	bltbit_set_addr(info->par, S1DREG_BBLT_DST_START0, dst);
+
+	/* 3) + 4) program width and height */
+	bltbit_set_size(info, width, height);
+
+	/* 5) source phase, we repack the bitmap so every line starts in the low byte */
+	bltbit_setreg(info->par, S1DREG_BBLT_SRC_START0, 0x00);
+
+	/* 6) + 7) program color expand blit, starting at bit 7 of the first byte */
+	bltbit_set_op(info->par, transparent ? BBLT_COLOR_EXP_TRANSP : BBLT_COLOR_EXP, 0x07);
+
+	/* 8) Program background color */
+	bltbit_setregw(info->par, S1DREG_BBLT_BGC0, bgcolor & 0xffff);
+
+	/* 9) Program foreground color */
+	bltbit_setregw(info->par, S1DREG_BBLT_FGC0, fgcolor & 0xffff);
+
+	/* 10) setup the bpp 1 = 16bpp, 0 = 8bpp*/
+	bltbit_setreg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+
+	/* 11) set words per xres */
+	bltbit_setregw(info->par, S1DREG_BBLT_MEM_OFF0, stride >> 1);
+
+	/* 12) calculate #words per line for the bitblt engine */
+	lwords = s1d13xxxfb_bitblt_expand_words(width, 0);
+
+	/* initialize the engine */
+	bltbit_start(info);
+
+	/* 14) wait to start */
+	bltbit_wait_bitset(info, BBLT_ACTIVE);
+
+	/* 15) feed the bitmap, low byte first, odd pitches get a padding byte */
+	for (h = 0; h < height; h++, src += pitch) {
+		for (x = 0; x < lwords; x++) {
+			data = src[x << 1];
+			if ((x << 1) + 1 < lbytes)
+				data |= src[(x << 1) + 1] << 8;
+
+			if (!credit)
+				credit = bltbit_fifo_credit(info);
+			s1d13xxxfb_writeregw(info->par, S1DREG_BBLT_DATA0, data);
+			credit--;
+		}
+	}
+
+	/* the engine is still busy with the last lines, don't wait for it */
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+/* 1bit blit acceleration - color expand, used for console text */
+static void
+s1d13xxxfb_bitblt_imageblit_1(struct fb_info *info, const struct fb_image *image)
+{
+	u32 fgcolor, bgcolor;
+
+	// Find out bg / fg color
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
+	    info->fix.visual == FB_VISUAL_DIRECTCOLOR) {
+		fgcolor = ((u32 *) (info->pseudo_palette))[image->fg_color];
+		bgcolor = ((u32 *) (info->pseudo_palette))[image->bg_color];
+	} else {
+		fgcolor = image->fg_color;
+		bgcolor = image->bg_color;
+	}
+
+	/* lines are padded to full bytes */
+	bltbit_expand(info, image->dx, image->dy, image->width, image->height,
+			(const u8 *)image->data, (image->width + 7) >> 3,
+			fgcolor, bgcolor, 0);
+}
+
+/**
+ *	bltbit_fifo_burst8 - writes 8 words to the BitBLT FIFO
+ *	@port : FIFO data port
+ *	@src  : 32bit aligned source
+ *
+ *	the data port decodes the whole 0x100000 aperture, so the
+ *	incrementing addresses of a store multiple all end up in the FIFO
+ *
+ */
+static inline void
+bltbit_fifo_burst8(void __iomem *port, const u16 *src)
+{
+#ifdef CONFIG_ARM
+	__asm__ __volatile__(
+		"ldmia	%0, {r4-r7}\n\t"
+		"stmia	%1, {r4-r7}\n\t"
+		:
+		: "r" (src), "r" (port)
+		: "r4", "r5", "r6", "r7", "memory");
+#else
+	const u32 *s = (const u32 *)src;
+
+	__raw_writel(s[0], port);
+	__raw_writel(s[1], port + 4);
+	__raw_writel(s[2], port + 8);
+	__raw_writel(s[3], port + 12);
+#endif
+}
+
+/**
+ *	bltbit_fifo_write - streams words into the BitBLT FIFO
+ *	@info   : frambuffer structure
+ *	@src    : 16bit aligned source
+ *	@nwords : number of words
+ *	@credit : words the FIFO can still take, carried between calls
+ *
+ *	the status register is only read when the credit runs out. Pairs
+ *	of words are written as one 32bit access (two back-to-back 16bit
+ *	cycles on the Jornada bus), 8 words at a time with ldm/stm.
+ *
+ */
+static void
+bltbit_fifo_write(struct fb_info *info, const u16 *src, u32 nwords, int *credit)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	void __iomem *port = par->regs + S1DREG_BBLT_DATA0;
+	u32 chunk;
+
+	while (nwords) {
+		if (!*credit)
+			*credit = bltbit_fifo_credit(info);
+
+		chunk = min_t(u32, nwords, *credit);
+		*credit -= chunk;
+		nwords -= chunk;
+
+		/* get the source 32bit aligned */
+		if (((unsigned long)src & 2) && chunk) {
+			__raw_writew(*src++, port);
+			chunk--;
+		}
+
+		while (chunk >= 8) {
+			bltbit_fifo_burst8(port, src);
+			src += 8;
+			chunk -= 8;
+		}
+
+		while (chunk >= 2) {
+			__raw_writel(*(const u32 *)src, port);
+			src += 2;
+			chunk -= 2;
+		}
+
+		if (chunk)
+			__raw_writew(*src++, port);
+	}
+}
+
+/**
+ *	bltbit_write_setup - programs and starts a write blit
+ *	@info   : framebuffer structure
+ *	@dx     : destination x in engine pixels
+ *	@dy     : destination y
+ *	@width  : width in engine pixels
+ *	@height : height in lines
+ *	@phase  : source phase
+ *	@rop    : BBLT_ROP_xxx
+ *	@key    : color key of a transparent write, or BBLT_NO_KEY
+ *
+ *	returns the number of FIFO words per line, the caller has to
+ *	feed them. Called with the bitblt lock held.
+ */
+static u32
+bltbit_write_setup(struct fb_info *info, u32 dx, u32 dy,
+			u32 width, u32 height, u8 phase, u8 rop, int key)
+{
+	u32 dst, stride;
+	u16 bpp = bltbit_bytespp(info);
+
+	/* bytes per line */
+	stride = bltbit_stride(info);
+
+	/* 1) Calculate destination address in screen memory */
+	dst = ((dy * stride) + (bpp * dx));
+
+	bltbit_begin(info, S1D_BLT_WRITE);
+
+	/* 2) set destination address */
+	bltbit_set_addr(info->par, S1DREG_BBLT_DST_START0, dst);
+
+	/* 3) + 4) program width and height */
+	bltbit_set_size(info, width, height);
+
+	/* 5) source phase */
+	bltbit_setreg(info->par, S1DREG_BBLT_SRC_START0, phase);
+
+	/* 6) + 7) program WriteBlt with ROP, or transparent with the key as background */
+	if (key != BBLT_NO_KEY) {
+		bltbit_setregw(info->par, S1DREG_BBLT_BGC0, key & 0xffff);
+		bltbit_set_op(info->par, BBLT_WRITE_TRANSP, BBLT_ROP_COPY);
+	} else {
+		bltbit_set_op(info->par, BBLT_WRITE, rop);
+	}
+
+	/* 8) setup the bpp 1 = 16bpp, 0 = 8bpp*/
+	bltbit_setreg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+
+	/* 9) set words per xres */
+	bltbit_setregw(info->par, S1DREG_BBLT_MEM_OFF0, stride >> 1);
+
+	/* initialize the engine */
+	bltbit_start(info);
+
+	/* wait for  engine to startup */
+	bltbit_wait_bitset(info, BBLT_ACTIVE);
+
+	/* 10) calculate #words per line for the bitblt engine */
+	/*    nwords = ((width * bpp + sourcephase + 1) / 2) * height */
+	return (width * bpp + phase + 1) >> 1;
+}
+
+/**
+ *	s1d13xxxfb_bitblt_writeblit - copies an image from memory to VRAM
+ *	@info   : framebuffer structure
+ *	@dx     : destination x in engine pixels
+ *	@dy     : destination y
+ *	@width  : width in engine pixels
+ *	@height : height in lines
+ *	@src    : first pixel, any alignment
+ *	@pitch  : bytes from one source line to the next
+ *	@rop    : BBLT_ROP_xxx
+ *	@key    : color key of a transparent write, or BBLT_NO_KEY
+ *
+ *	Write BitBLT in the current depth. An odd source address is
+ *	handled with the source phase: the FIFO gets the aligned words
+ *	around every line and the engine drops the first byte. All lines
+ *	share the phase, so an odd pitch goes through a bounce line.
+ *
+ *	called with the bitblt lock held
+ */
+static void
+s1d13xxxfb_bitblt_writeblit(struct fb_info *info, u32 dx, u32 dy,
+			u32 width, u32 height, const u8 *src, u32 pitch,
+			u8 rop, int key)
+{
+	u32 lwords, h, x;
+	u16 bpp = bltbit_bytespp(info);
+	u8 phase = (unsigned long)src & 1;
+	int credit = 0;
+	u16 data;
+
+	/* all lines share the source phase */
+	if (pitch & 1)
+		phase = 0;
+
+	lwords = bltbit_write_setup(info, dx, dy, width, height, phase, rop, key);
+
+	/* 11) write the lines to the blt-fifo */
+	if (!(pitch & 1) && lwords * 2 == pitch && !phase) {
+		/* contiguous lines, one stream */
+		bltbit_fifo_write(info, (const u16 *)src, lwords * height, &credit);
+	} else if (!(pitch & 1)) {
+		/* the words around an odd line start include one byte before
+		   and after the line, they are in the same halfword so this
+		   can't fault */
+		for (h = 0; h < height; h++, src += pitch)
+			bltbit_fifo_write(info, (const u16 *)(src - phase), lwords, &credit);
+	} else {
+		for (h = 0; h < height; h++, src += pitch) {
+			for (x = 0; x < lwords; x++) {
+				data = src[x << 1];
+				if ((x << 1) + 1 < width * bpp)
+					data |= src[(x << 1) + 1] << 8;
+
+				if (!credit)
+					credit = bltbit_fifo_credit(info);
+				s1d13xxxfb_writeregw(info->par, S1DREG_BBLT_DATA0, data);
+				credit--;
+			}
+		}
+	}
+
+	/* the engine is still busy with the last lines, don't wait for it */
+}
+
+/* 8/16bit blit acceleration, image in screen depth */
+static void
+s1d13xxxfb_bitblt_imageblit_native(struct fb_info *info, const struct fb_image *image)
+{
+	// wait for engine to be free
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+
+	s1d13xxxfb_bitblt_writeblit(info, image->dx, image->dy,
+			image->width, image->height,
+			(const u8 *)image->data, image->width * bltbit_bytespp(info),
+			BBLT_ROP_COPY, BBLT_NO_KEY);
+
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+/* 4bit blit acceleration - 1bit and 8bit images packed by the CPU, written at 8bpp */
+static void
+s1d13xxxfb_bitblt_imageblit_4(struct fb_info *info, const struct fb_image *image)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u8 *line = (u8 *)par->blt_line;
+	u32 lbytes = image->width >> 1;
+	const u8 *src = (const u8 *)image->data;
+	u32 pitch, lwords, h, x;
+	int hi_first = fb_be_math(info);
+	int credit = 0;
+	u8 fg = image->fg_color & 0x0f;
+	u8 bg = image->bg_color & 0x0f;
+	u8 tab[4];
+
+	/* two glyph bits -> one byte */
+	for (x = 0; x < 4; x++)
+		tab[x] = bltbit_pack4(hi_first, (x & 2) ? fg : bg, (x & 1) ? fg : bg);
+
+	if (image->depth == 1)
+		pitch = (image->width + 7) >> 3;
+	else
+		pitch = image->width;
+
+	// wait for engine to be free
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+
+	lwords = bltbit_write_setup(info, image->dx >> 1, image->dy,
+			lbytes, image->height, 0, BBLT_ROP_COPY, BBLT_NO_KEY);
+
+	for (h = 0; h < image->height; h++, src += pitch) {
+		if (image->depth == 1) {
+			for (x = 0; x < lbytes; x++)
+				line[x] = tab[(src[x >> 2] >> (6 - ((x & 3) << 1))) & 3];
+		} else {
+			for (x = 0; x < lbytes; x++)
+				line[x] = bltbit_pack4(hi_first, src[x << 1] & 0x0f,
+						src[(x << 1) + 1] & 0x0f);
+		}
+		bltbit_fifo_write(info, (const u16 *)line, lwords, &credit);
+	}
+
+	spin_unlock(&s1d13xxxfb_bitblt_lock);
+}
+
+static void
+s1d13xxxfb_bitblt_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+        if (info->state != FBINFO_STATE_RUNNING)
+        return;
+
+	if (!image->width || !image->height)
+		return;
+
+	// Call SW impl if acceleration is disabled
+	if (info->flags & FBINFO_HWACCEL_DISABLED) {
+		s1d13xxxfb_sync(info);
+		cfb_imageblit(info, image);
+		return;
+	}
+	
+	// 4bpp is packed by the CPU and written as bytes, so x and width
+	// have to be even and a line has to fit the bounce buffer
+	if (info->var.bits_per_pixel == 4) {
+		if (((image->dx | image->width) & 1) ||
+		    (image->width >> 1) > S1D_BBLT_LINE_MAX ||
+		    (image->depth != 1 && image->depth != 8)) {
+			s1d13xxxfb_sync(info);
+			cfb_imageblit(info, image);
+			return;
+		}
+		s1d13xxxfb_bitblt_imageblit_4(info, image);
+		return;
+	}
+
+	// Depending on bit depth of the fb_image, different logic is needed
+	// 1bit:  text console -> color expand blit
+	// 8/16bit in screen depth: GUIs -> write blit
+	// others: fallback to software impl.
+	if (image->depth == 1) {
+		s1d13xxxfb_bitblt_imageblit_1(info, image);
+		return;
+	}
+
+	if (image->depth == info->var.bits_per_pixel &&
+	    (image->depth == 8 || image->depth == 16)) {
+		s1d13xxxfb_bitblt_imageblit_native(info, image);
+		return;
+	}
+
+	s1d13xxxfb_sync(info);
+	cfb_imageblit(info, image);
+}
+
+/************************************************************
+ offscreen VRAM
+
+ The lines between the virtual screen and smem_len are handed out
+ by a small first fit allocator. Callers hold the console lock.
+ ************************************************************/
+
+/**
+ *	s1d13xxxfb_offscreen_init - takes VRAM away from the virtual screen
+ *	@info : framebuffer structure
+ *	@size : bytes wanted, rounded up to whole lines
+ *
+ *	At least one visible page is left, so the area might be smaller.
+ */
+static void
+s1d13xxxfb_offscreen_init(struct fb_info *info, u32 size)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 lines = info->fix.smem_len / info->fix.line_length;
+
+	lines -= min(lines - info->var.yres, DIV_ROUND_UP(size, info->fix.line_length));
+	info->var.yres_virtual = lines;
+	par->offscreen_base = lines * info->fix.line_length;
+	memset(par->offscreen, 0, sizeof(par->offscreen));
+}
+
+/**
+ *	s1d13xxxfb_offscreen_alloc - allocates offscreen VRAM
+ *	@info  : framebuffer structure
+ *	@size  : bytes
+ *	@align : alignment of the offset, line_length for blit sources
+ *
+ *	Returns the offset into VRAM, or 0 if there is no room.
+ */
+static u32
+s1d13xxxfb_offscreen_alloc(struct fb_info *info, u32 size, u32 align)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_offscreen *area = par->offscreen;
+	u32 start = par->offscreen_base;
+	u32 end;
+	int i, n;
+
+	for (n = 0; n < S1D_OFFSCREEN_MAX && area[n].size; n++)
+		;
+	if (!size || n == S1D_OFFSCREEN_MAX)
+		return 0;
+
+	/* the gaps in front of each area and behind the last one */
+	for (i = 0; i <= n; i++) {
+		end = (i < n) ? area[i].offset : info->fix.smem_len;
+		start = roundup(start, align);
+		if (start + size <= end) {
+			memmove(&area[i + 1], &area[i], (n - i) * sizeof(*area));
+			area[i].offset = start;
+			area[i].size = size;
+			return start;
+		}
+		if (i < n)
+			start = area[i].offset + area[i].size;
+	}
+
+	return 0;
+}
+
+static void
+s1d13xxxfb_offscreen_free(struct fb_info *info, u32 offset)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_offscreen *area = par->offscreen;
+	int i;
+
+	for (i = 0; i < S1D_OFFSCREEN_MAX && area[i].size; i++) {
+		if (area[i].offset != offset)
+			continue;
+		memmove(&area[i], &area[i + 1],
+			(S1D_OFFSCREEN_MAX - i - 1) * sizeof(*area));
+		memset(&area[S1D_OFFSCREEN_MAX - 1], 0, sizeof(*area));
+		return;
+	}
+}
+
+#ifdef CONFIG_FB_TILEBLITTING
+/************************************************************
+ console tile ops
+
+ fbcon hands us the font once and then draws by character index.
+ Each glyph is color expanded once into a slot of offscreen VRAM
+ and from then on drawn with a VRAM to VRAM move blit. The cache is
+ direct mapped by index, a slot remembers the colors it was expanded
+ with. Without a cache (4bpp, shadow, no offscreen VRAM) glyphs go
+ through fb_imageblit as with the bit ops.
+ ************************************************************/
+
+#define GLYPH_VALID	0x80000000
+
+static inline int
+s1d13xxxfb_glyph_cached(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	return par->glyph_offset && !(info->flags & FBINFO_HWACCEL_DISABLED);
+}
+
+/**
+ *	s1d13xxxfb_glyph_cache_init - sets up the slots for the current font and mode
+ *	@info : framebuffer structure
+ *
+ *	Halves the number of slots until they fit into the offscreen VRAM.
+ */
+static void
+s1d13xxxfb_glyph_cache_init(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 cols, rows, slots;
+	u32 offset = 0;
+
+	if (par->glyph_offset)
+		s1d13xxxfb_offscreen_free(info, par->glyph_offset);
+	par->glyph_offset = 0;
+	memset(par->glyph_tag, 0, sizeof(par->glyph_tag));
+
+	if (!par->tile_data || par->prod_id != S1D13506_PROD_ID ||
+	    info->var.bits_per_pixel < 8)
+		return;
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (par->shadow)
+		return;
+#endif
+
+	cols = info->var.xres_virtual / par->tile_width;
+	if (!cols)
+		return;
+
+	for (slots = min_t(u32, par->tile_count, S1D_GLYPH_MAX); slots; slots >>= 1) {
+		rows = DIV_ROUND_UP(slots, cols);
+		offset = s1d13xxxfb_offscreen_alloc(info,
+				rows * par->tile_height * info->fix.line_length,
+				info->fix.line_length);
+		if (offset)
+			break;
+	}
+	if (!offset)
+		return;
+
+	par->glyph_offset = offset;
+	par->glyph_slots = slots;
+	par->glyph_cols = cols;
+	dbg_blit("(glyph cache) %d slots at 0x%x\n", slots, offset);
+}
+
+/**
+ *	s1d13xxxfb_tile_draw - draws one character
+ *	@info  : framebuffer structure
+ *	@index : character
+ *	@x, @y : pixel position
+ *	@fg, @bg : colors
+ */
+static void
+s1d13xxxfb_tile_draw(struct fb_info *info, u32 index, u32 x, u32 y, u32 fg, u32 bg)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct fb_image image;
+	struct fb_copyarea area;
+	u32 slot, tag;
+
+	index %= par->tile_count;
+
+	memset(&image, 0, sizeof(image));
+	image.dx = x;
+	image.dy = y;
+	image.width = par->tile_width;
+	image.height = par->tile_height;
+	image.fg_color = fg;
+	image.bg_color = bg;
+	image.depth = 1;
+	image.data = (const char *)par->tile_data + index * par->tile_bytes;
+
+	if (!s1d13xxxfb_glyph_cached(info)) {
+		info->fbops->fb_imageblit(info, &image);
+		return;
+	}
+
+	slot = index % par->glyph_slots;
+	area.sx = (slot % par->glyph_cols) * par->tile_width;
+	area.sy = par->glyph_offset / info->fix.line_length +
+		  (slot / par->glyph_cols) * par->tile_height;
+
+	/* miss: expand the glyph into its slot first */
+	tag = GLYPH_VALID | (index << 16) | ((bg & 0xff) << 8) | (fg & 0xff);
+	if (par->glyph_tag[slot] != tag) {
+		image.dx = area.sx;
+		image.dy = area.sy;
+		s1d13xxxfb_bitblt_imageblit(info, &image);
+		par->glyph_tag[slot] = tag;
+	}
+
+	area.dx = x;
+	area.dy = y;
+	area.width = par->tile_width;
+	area.height = par->tile_height;
+	s1d13xxxfb_bitblt_copyarea(info, &area);
+}
+
+/* XORs the software cursor, for when the Ink/Cursor unit isn't ours */
+static void
+s1d13xxxfb_tile_xor_cursor(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct fb_fillrect rect;
+
+	rect.dx = par->tile_cursor_x;
+	rect.dy = par->tile_cursor_y + par->tile_height - par->tile_cursor_h;
+	rect.width = par->tile_width;
+	rect.height = par->tile_cursor_h;
+	rect.color = par->tile_cursor_color;
+	rect.rop = ROP_XOR;
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (par->shadow) {
+		info->fbops->fb_fillrect(info, &rect);
+		return;
+	}
+#endif
+	s1d13xxxfb_sync(info);
+	cfb_fillrect(info, &rect);
+}
+
+/* characters drawn over the software cursor take it with them */
+static void
+s1d13xxxfb_tile_touch(struct fb_info *info, u32 sx, u32 sy, u32 width, u32 height)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 cx = par->tile_cursor_x / par->tile_width;
+	u32 cy = par->tile_cursor_y / par->tile_height;
+
+	if (par->tile_cursor_on && cx >= sx && cx < sx + width &&
+	    cy >= sy && cy < sy + height)
+		par->tile_cursor_on = 0;
+}
+
+static void
+s1d13xxxfb_settile(struct fb_info *info, struct fb_tilemap *map)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	if (map->depth != 1 || !map->width || !map->height || !map->length) {
+		par->tile_data = NULL;
+		return;
+	}
+
+	par->tile_data = map->data;
+	par->tile_width = map->width;
+	par->tile_height = map->height;
+	par->tile_count = map->length;
+	par->tile_bytes = DIV_ROUND_UP(map->width, 8) * map->height;
+	par->tile_cursor_on = 0;
+
+	s1d13xxxfb_glyph_cache_init(info);
+}
+
+static void
+s1d13xxxfb_tilecopy(struct fb_info *info, struct fb_tilearea *area)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct fb_copyarea copy;
+
+	s1d13xxxfb_tile_touch(info, area->dx, area->dy, area->width, area->height);
+
+	copy.sx = area->sx * par->tile_width;
+	copy.sy = area->sy * par->tile_height;
+	copy.dx = area->dx * par->tile_width;
+	copy.dy = area->dy * par->tile_height;
+	copy.width = area->width * par->tile_width;
+	copy.height = area->height * par->tile_height;
+	info->fbops->fb_copyarea(info, &copy);
+}
+
+static void
+s1d13xxxfb_tilefill(struct fb_info *info, struct fb_tilerect *rect)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	const u8 *glyph;
+	struct fb_fillrect fill;
+	u32 x, y, i;
+
+	if (!par->tile_data)
+		return;
+
+	s1d13xxxfb_tile_touch(info, rect->sx, rect->sy, rect->width, rect->height);
+
+	/* erasing with blanks is a single fill */
+	glyph = par->tile_data + (rect->index % par->tile_count) * par->tile_bytes;
+	for (i = 0; i < par->tile_bytes && !glyph[i]; i++)
+		;
+	if (i == par->tile_bytes) {
+		fill.dx = rect->sx * par->tile_width;
+		fill.dy = rect->sy * par->tile_height;
+		fill.width = rect->width * par->tile_width;
+		fill.height = rect->height * par->tile_height;
+		fill.color = rect->bg;
+		fill.rop = ROP_COPY;
+		info->fbops->fb_fillrect(info, &fill);
+		return;
+	}
+
+	for (y = rect->sy; y < rect->sy + rect->height; y++)
+		for (x = rect->sx; x < rect->sx + rect->width; x++)
+			s1d13xxxfb_tile_draw(info, rect->index, x * par->tile_width,
+					y * par->tile_height, rect->fg, rect->bg);
+}
+
+static void
+s1d13xxxfb_tileblit(struct fb_info *info, struct fb_tileblit *blit)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 x, y, i;
+
+	if (!par->tile_data || !blit->width)
+		return;
+
+	s1d13xxxfb_tile_touch(info, blit->sx, blit->sy, blit->width, blit->height);
+
+	for (i = 0; i < blit->length; i++) {
+		x = blit->sx + i % blit->width;
+		y = blit->sy + i / blit->width;
+		if (y >= blit->sy + blit->height)
+			break;
+		s1d13xxxfb_tile_draw(info, blit->indices[i], x * par->tile_width,
+				y * par->tile_height, blit->fg, blit->bg);
+	}
+}
+
+/**
+ *	s1d13xxxfb_tilecursor - the console cursor in tile mode
+ *	@info   : framebuffer structure
+ *	@cursor : cell, shape and whether to draw or erase
+ *
+ *	Uses the Ink/Cursor unit like fb_cursor does, and XORs the lower
+ *	rows of the cell when the unit is busy with the ink layer.
+ */
+static void
+s1d13xxxfb_tilecursor(struct fb_info *info, struct fb_tilecursor *cursor)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 w = par->tile_width, h = par->tile_height;
+	u32 pitch = DIV_ROUND_UP(w, 8);
+	struct fb_cursor hw;
+	u32 rows;
+
+	if (!par->tile_data)
+		return;
+
+	switch (cursor->shape) {
+	case FB_TILE_CURSOR_NONE:
+		rows = 0;
+		break;
+	case FB_TILE_CURSOR_UNDERLINE:
+		rows = (h < 10) ? 1 : 2;
+		break;
+	case FB_TILE_CURSOR_LOWER_THIRD:
+		rows = h / 3;
+		break;
+	case FB_TILE_CURSOR_LOWER_HALF:
+		rows = h >> 1;
+		break;
+	case FB_TILE_CURSOR_TWO_THIRDS:
+		rows = (h << 1) / 3;
+		break;
+	case FB_TILE_CURSOR_BLOCK:
+	default:
+		rows = h;
+		break;
+	}
+
+	/* take the software cursor away first, the unit may be ours again (ink off) */
+	if (par->tile_cursor_on) {
+		s1d13xxxfb_tile_xor_cursor(info);
+		par->tile_cursor_on = 0;
+	}
+
+	if (info->fbops->fb_cursor && w <= S1D_CURSOR_WIDTH && h <= S1D_CURSOR_HEIGHT) {
+		memset(par->tile_cursor_mask, 0, pitch * h);
+		memset(par->tile_cursor_mask + pitch * (h - rows), 0xff, pitch * rows);
+
+		memset(&hw, 0, sizeof(hw));
+		hw.set = FB_CUR_SETALL;
+		hw.enable = cursor->mode && rows;
+		hw.rop = ROP_XOR;
+		hw.mask = (const char *)par->tile_cursor_mask;
+		/* fb_cursor wants virtual screen coordinates, sx/sy are visible ones */
+		hw.image.dx = cursor->sx * w + info->var.xoffset;
+		hw.image.dy = cursor->sy * h + info->var.yoffset;
+		hw.image.width = w;
+		hw.image.height = h;
+		hw.image.fg_color = cursor->fg;
+		hw.image.bg_color = cursor->bg;
+		hw.image.depth = 1;
+		hw.image.data = (const char *)par->tile_cursor_mask;
+
+		if (info->fbops->fb_cursor(info, &hw) == 0)
+			return;
+	}
+
+	if (!cursor->mode || !rows)
+		return;
+
+	par->tile_cursor_x = cursor->sx * w + info->var.xoffset;
+	par->tile_cursor_y = cursor->sy * h + info->var.yoffset;
+	par->tile_cursor_h = rows;
+	par->tile_cursor_color = cursor->fg;
+	s1d13xxxfb_tile_xor_cursor(info);
+	par->tile_cursor_on = 1;
+}
+
+static int
+s1d13xxxfb_get_tilemax(struct fb_info *info)
+{
+	return S1D_GLYPH_MAX;
+}
+
+static struct fb_tile_ops s1d13xxxfb_tileops = {
+	.fb_settile	= s1d13xxxfb_settile,
+	.fb_tilecopy	= s1d13xxxfb_tilecopy,
+	.fb_tilefill	= s1d13xxxfb_tilefill,
+	.fb_tileblit	= s1d13xxxfb_tileblit,
+	.fb_tilecursor	= s1d13xxxfb_tilecursor,
+	.fb_get_tilemax	= s1d13xxxfb_get_tilemax,
+};
+#endif /* CONFIG_FB_TILEBLITTING */
+
+#ifdef CONFIG_FB_DEFERRED_IO
+/************************************************************
+ shadow framebuffer
+
+ With shadow=1 the framebuffer lives in cached RAM. mmap clients
+ write into it through fb_deferred_io, which collects the touched
+ pages, the console draws into it with cfb_*. Every 1/shadow_fps
+ seconds the dirty lines are compared tile by tile with a copy of
+ what VRAM holds and only the changed tiles are written, with the
+ write BitBLT where the engine is available.
+ ************************************************************/
+
+static inline u32
+s1d13xxxfb_shadow_lines(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	return min_t(u32, info->fix.smem_len / info->fix.line_length, par->shadow_bits);
+}
+
+/* mark lines dirty, the caller schedules the flush */
+static void
+s1d13xxxfb_shadow_mark(struct fb_info *info, u32 y, u32 height)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 lines = s1d13xxxfb_shadow_lines(info);
+	unsigned long flags;
+
+	if (y >= lines)
+		return;
+	if (height > lines - y)
+		height = lines - y;
+
+	spin_lock_irqsave(&par->shadow_lock, flags);
+	bitmap_set(par->shadow_dirty, y, height);
+	spin_unlock_irqrestore(&par->shadow_lock, flags);
+}
+
+static void
+s1d13xxxfb_shadow_damage(struct fb_info *info, u32 y, u32 height)
+{
+	s1d13xxxfb_shadow_mark(info, y, height);
+	schedule_delayed_work(&info->deferred_work, info->fbdefio->delay);
+}
+
+/* does a tile of the shadow differ from VRAM */
+static int
+s1d13xxxfb_shadow_tile_changed(struct fb_info *info, u32 offset, u32 bytes, u32 height)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 pitch = info->fix.line_length;
+
+	for (; height; height--, offset += pitch)
+		if (memcmp(par->shadow + offset, par->shadow_copy + offset, bytes))
+			return 1;
+	return 0;
+}
+
+/* write a rectangle of the shadow to VRAM */
+static void
+s1d13xxxfb_shadow_write_rect(struct fb_info *info, u32 x, u32 y, u32 width, u32 height)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 pitch = info->fix.line_length;
+	u32 bits = info->var.bits_per_pixel;
+	u32 offset = y * pitch + ((x * bits) >> 3);
+	u32 bytes = (width * bits) >> 3;
+	u32 h;
+
+	if (par->prod_id == S1D13506_PROD_ID &&
+	    !(info->flags & FBINFO_HWACCEL_DISABLED)) {
+		/* in 4bpp x and width are even, the engine works on bytes */
+		if (bits == 4) {
+			x >>= 1;
+			width >>= 1;
+		}
+		spin_lock(&s1d13xxxfb_bitblt_lock);
+		s1d13xxxfb_bitblt_writeblit(info, x, y, width, height,
+				par->shadow + offset, pitch, BBLT_ROP_COPY, BBLT_NO_KEY);
+		spin_unlock(&s1d13xxxfb_bitblt_lock);
+	} else {
+		s1d13xxxfb_sync(info);
+		for (h = 0; h < height; h++)
+			memcpy_toio(par->vram + offset + h * pitch,
+					par->shadow + offset + h * pitch, bytes);
+	}
+
+	for (h = 0; h < height; h++)
+		memcpy(par->shadow_copy + offset + h * pitch,
+				par->shadow + offset + h * pitch, bytes);
+}
+
+static void
+s1d13xxxfb_shadow_flush(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_shadow_stats *stats = &par->shadow_stats;
+	u32 lines = s1d13xxxfb_shadow_lines(info);
+	u32 pitch = info->fix.line_length;
+	u32 bits = info->var.bits_per_pixel;
+	u32 xres = (pitch << 3) / bits;
+	u32 tile, y, y0, y1, x, w, run_x, run_w;
+	unsigned long dirty = 0, written = 0;
+	unsigned long flags;
+	ktime_t start = ktime_get();
+	int force;
+
+	/* tiles are at least 4 and an even number of pixels */
+	tile = clamp_t(u32, shadow_tile, 4, 128) & ~1;
+
+	spin_lock_irqsave(&par->shadow_lock, flags);
+	memcpy(par->shadow_flush, par->shadow_dirty,
+		BITS_TO_LONGS(par->shadow_bits) * sizeof(unsigned long));
+	bitmap_zero(par->shadow_dirty, par->shadow_bits);
+	force = par->shadow_force;
+	par->shadow_force = 0;
+	spin_unlock_irqrestore(&par->shadow_lock, flags);
+
+	for (y0 = 0; y0 < lines; y0 += tile) {
+		/* the dirty lines of this band of tiles */
+		y = find_next_bit(par->shadow_flush, y0 + tile, y0);
+		if (y >= min(y0 + tile, lines))
+			continue;
+		y1 = min(y0 + tile, lines);
+		while (y1 > y && !test_bit(y1 - 1, par->shadow_flush))
+			y1--;
+		dirty += (y1 - y) * pitch;
+
+		/* neighbouring changed tiles are written in one go */
+		run_x = run_w = 0;
+		for (x = 0; x < xres; x += tile) {
+			w = min(tile, xres - x);
+			if (force || s1d13xxxfb_shadow_tile_changed(info,
+					y * pitch + ((x * bits) >> 3),
+					(w * bits) >> 3, y1 - y)) {
+				if (!run_w)
+					run_x = x;
+				run_w += w;
+				continue;
+			}
+			if (run_w) {
+				s1d13xxxfb_shadow_write_rect(info, run_x, y, run_w, y1 - y);
+				written += ((run_w * bits) >> 3) * (y1 - y);
+				run_w = 0;
+			}
+		}
+		if (run_w) {
+			s1d13xxxfb_shadow_write_rect(info, run_x, y, run_w, y1 - y);
+			written += ((run_w * bits) >> 3) * (y1 - y);
+		}
+	}
+
+	if (dirty) {
+		stats->frames++;
+		stats->last_dirty = dirty;
+		stats->last_written = written;
+		stats->last_us = (unsigned long)ktime_us_delta(ktime_get(), start);
+		stats->dirty += dirty;
+		stats->written += written;
+	}
+
+	/* pick up a changed flush rate */
+	par->shadow_defio.delay = max(HZ / clamp(shadow_fps, 1, 100), 1);
+}
+
+/* called by fb_deferred_io with the pages mmap clients wrote to */
+static void
+s1d13xxxfb_shadow_deferred_io(struct fb_info *info, struct list_head *pagelist)
+{
+	u32 pitch = info->fix.line_length;
+	struct page *page;
+	u32 start, end;
+
+	list_for_each_entry(page, pagelist, lru) {
+		start = (page->index << PAGE_SHIFT) / pitch;
+		end = (((page->index + 1) << PAGE_SHIFT) - 1) / pitch;
+		s1d13xxxfb_shadow_mark(info, start, end - start + 1);
+	}
+
+	s1d13xxxfb_shadow_flush(info);
+}
+
+static void
+s1d13xxxfb_shadow_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+	cfb_fillrect(info, rect);
+	s1d13xxxfb_shadow_damage(info, rect->dy, rect->height);
+}
+
+static void
+s1d13xxxfb_shadow_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	cfb_copyarea(info, area);
+	s1d13xxxfb_shadow_damage(info, area->dy, area->height);
+}
+
+static void
+s1d13xxxfb_shadow_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+	cfb_imageblit(info, image);
+	s1d13xxxfb_shadow_damage(info, image->dy, image->height);
+}
+
+/* write() on /dev/fb, the default one doesn't know about the shadow */
+static ssize_t
+s1d13xxxfb_shadow_write(struct fb_info *info, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	unsigned long p = *ppos;
+	u32 size = info->fix.smem_len;
+	u32 pitch = info->fix.line_length;
+
+	if (p >= size)
+		return -EFBIG;
+
+	if (count > size - p)
+		count = size - p;
+	if (!count)
+		return -ENOSPC;
+
+	if (copy_from_user(info->screen_base + p, buf, count))
+		return -EFAULT;
+
+	*ppos += count;
+	s1d13xxxfb_shadow_damage(info, p / pitch, (p + count - 1) / pitch - p / pitch + 1);
+
+	return count;
+}
+
+/* redraw everything at the next flush */
+static void
+s1d13xxxfb_shadow_invalidate(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	unsigned long flags;
+
+	if (!par->shadow)
+		return;
+
+	spin_lock_irqsave(&par->shadow_lock, flags);
+	bitmap_fill(par->shadow_dirty, par->shadow_bits);
+	par->shadow_force = 1;
+	spin_unlock_irqrestore(&par->shadow_lock, flags);
+
+	schedule_delayed_work(&info->deferred_work, info->fbdefio->delay);
+}
+
+/**
+ *	s1d13xxxfb_shadow_init - switches the framebuffer to a RAM shadow
+ *	@info : framebuffer structure
+ *
+ *	screen_base is pointed at a vmalloc()ed copy of VRAM, which
+ *	fb_deferred_io needs for its page tracking. The caller replaces
+ *	the drawing functions by the s1d13xxxfb_shadow_* ones.
+ *
+ *	Returns negative errno on error, or zero on success.
+ */
+static int
+s1d13xxxfb_shadow_init(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 size = info->fix.smem_len;
+
+	/* enough bits for lines down to 64 bytes */
+	par->shadow_bits = DIV_ROUND_UP(size, 64);
+
+	par->shadow = vmalloc(PAGE_ALIGN(size));
+	par->shadow_copy = vmalloc(size);
+	par->shadow_dirty = kcalloc(BITS_TO_LONGS(par->shadow_bits), sizeof(unsigned long), GFP_KERNEL);
+	par->shadow_flush = kcalloc(BITS_TO_LONGS(par->shadow_bits), sizeof(unsigned long), GFP_KERNEL);
+
+	if (!par->shadow || !par->shadow_copy || !par->shadow_dirty || !par->shadow_flush) {
+		vfree(par->shadow);
+		vfree(par->shadow_copy);
+		kfree(par->shadow_dirty);
+		kfree(par->shadow_flush);
+		par->shadow = NULL;
+		return -ENOMEM;
+	}
+
+	/* start with what is on the screen */
+	memcpy_fromio(par->shadow, par->vram, size);
+	memcpy(par->shadow_copy, par->shadow, size);
+	spin_lock_init(&par->shadow_lock);
 
-	dbg_blit("(solidfill) dx=%d, dy=%d, stride=%d, dest=%d\n"
-		 "(solidfill) : rect_width=%d, rect_height=%d\n",
-				rect->dx, rect->dy, screen_stride, dest,
-				rect->width - 1, rect->height - 1);
+	par->shadow_defio.delay = max(HZ / clamp(shadow_fps, 1, 100), 1);
+	par->shadow_defio.deferred_io = s1d13xxxfb_shadow_deferred_io;
 
-	dbg_blit("(solidfill) : xres=%d, yres=%d, bpp=%d\n",
-				info->var.xres, info->var.yres,
-				info->var.bits_per_pixel);
-	dbg_blit("(solidfill) : rop=%d\n", rect->rop);
+	info->screen_base = (char __iomem *)par->shadow;
+	info->fbdefio = &par->shadow_defio;
+	fb_deferred_io_init(info);
+	info->flags |= FBINFO_VIRTFB;
 
-	/* wait for engine to be free */
-	spin_lock(&s1d13xxxfb_bitblt_lock);
+	printk(KERN_INFO PFX "shadow framebuffer, %d flushes/s, %d pixel tiles\n",
+		clamp(shadow_fps, 1, 100), clamp(shadow_tile, 4, 128) & ~1);
+	return 0;
+}
 
-	/* We split the destination into the three registers */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START0, (dest & 0x00ff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START1, ((dest >> 8) & 0x00ff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START2, ((dest >> 16) & 0x00ff));
+static void
+s1d13xxxfb_shadow_exit(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
 
-	/* give information regarding rectangel width */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH0, ((rect->width) & 0x00ff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH1, (rect->width >> 8));
+	if (!par->shadow)
+		return;
 
-	/* give information regarding rectangel height */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT0, ((rect->height) & 0x00ff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT1, (rect->height >> 8));
+	fb_deferred_io_cleanup(info);
+	info->screen_base = par->vram;
 
-	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
-		info->fix.visual == FB_VISUAL_DIRECTCOLOR) {
-		fg = ((u32 *)info->pseudo_palette)[rect->color];
-		dbg_blit("(solidfill) truecolor/directcolor\n");
-		dbg_blit("(solidfill) pseudo_palette[%d] = %d\n", rect->color, fg);
+	/* the fb_ops are shared by all binds, undo what probe patched in */
+	par->defio_mmap = NULL;
+	s1d13xxxfb_fbops.fb_mmap = s1d13xxxfb_mmap;
+	s1d13xxxfb_fbops.fb_write = NULL;
+	if (par->prod_id == S1D13506_PROD_ID) {
+		s1d13xxxfb_fbops.fb_fillrect = s1d13xxxfb_bitblt_solidfill;
+		s1d13xxxfb_fbops.fb_copyarea = s1d13xxxfb_bitblt_copyarea;
+		s1d13xxxfb_fbops.fb_imageblit = s1d13xxxfb_bitblt_imageblit;
 	} else {
-		fg = rect->color;
-		dbg_blit("(solidfill) color = %d\n", rect->color);
+		s1d13xxxfb_fbops.fb_fillrect = cfb_fillrect;
+		s1d13xxxfb_fbops.fb_copyarea = cfb_copyarea;
+		s1d13xxxfb_fbops.fb_imageblit = cfb_imageblit;
 	}
 
-	/* set foreground color */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_FGC0, (fg & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_FGC1, (fg >> 8) & 0xff);
+	vfree(par->shadow);
+	vfree(par->shadow_copy);
+	kfree(par->shadow_dirty);
+	kfree(par->shadow_flush);
+	par->shadow = NULL;
+}
 
-	/* set rectangual region of memory (rectangle and not linear) */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x0);
+static ssize_t
+s1d13xxxfb_shadow_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_shadow_stats *stats = &par->shadow_stats;
+
+	if (!par->shadow)
+		return sprintf(buf, "disabled\n");
+
+	return sprintf(buf,
+		"frames        %lu\n"
+		"dirty bytes   %lu\n"
+		"written bytes %lu\n"
+		"saved bytes   %lu\n"
+		"flush us      %lu\n"
+		"total dirty   %llu\n"
+		"total written %llu\n"
+		"total saved   %llu\n",
+		stats->frames, stats->last_dirty, stats->last_written,
+		stats->last_dirty - stats->last_written, stats->last_us,
+		(unsigned long long)stats->dirty, (unsigned long long)stats->written,
+		(unsigned long long)(stats->dirty - stats->written));
+}
 
-	/* set operation mode SOLID_FILL */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_OP, BBLT_SOLID_FILL);
+static ssize_t
+s1d13xxxfb_shadow_stats_store(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct s1d13xxxfb_par *par = info->par;
 
-	/* set bits per pixel (1 = 16bpp, 0 = 8bpp) */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL1, (info->var.bits_per_pixel >> 4));
+	memset(&par->shadow_stats, 0, sizeof(par->shadow_stats));
+	return count;
+}
 
-	/* set the memory offset for the bblt in word sizes */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF0, (screen_stride >> 1) & 0x00ff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF1, (screen_stride >> 9));
+static DEVICE_ATTR(shadow_stats, S_IRUGO | S_IWUSR,
+		s1d13xxxfb_shadow_stats_show, s1d13xxxfb_shadow_stats_store);
+#endif /* CONFIG_FB_DEFERRED_IO */
 
-	/* and away we go.... */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x80);
+/*
+ * bitblt statistics, writing anything resets them
+ */
+static const char *s1d13xxxfb_blt_op_names[S1D_BLT_NR_OPS] = {
+	"copy",
+	"fill",
+	"expand",
+	"write",
+	"pattern",
+};
 
-	/* Wait for the blit to complete */
-	bltbit_wait_bitclear(info, 0x80);
+static ssize_t
+s1d13xxxfb_bitblt_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct s1d13xxxfb_par *par = info->par;
+	ssize_t len;
+	int i;
 
-	/* let others play */
+	len = sprintf(buf, "%-8s %10s %10s %10s\n", "op", "calls", "writes", "saved");
+	for (i = 0; i < S1D_BLT_NR_OPS; i++)
+		len += sprintf(buf + len, "%-8s %10lu %10lu %10lu\n",
+			s1d13xxxfb_blt_op_names[i], par->blt_stats[i].calls,
+			par->blt_stats[i].writes, par->blt_stats[i].saved);
+
+	return len;
+}
+
+static ssize_t
+s1d13xxxfb_bitblt_stats_store(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct s1d13xxxfb_par *par = info->par;
+
+	spin_lock(&s1d13xxxfb_bitblt_lock);
+	memset(par->blt_stats, 0, sizeof(par->blt_stats));
 	spin_unlock(&s1d13xxxfb_bitblt_lock);
+
+	return count;
 }
 
-/*
-struct fb_image {
-    __u32 dx;       Where to place image 
-    __u32 dy;
-    __u32 width;        Size of image
-    __u32 height;
-    __u32 fg_color;     Only used when a mono bitmap
-    __u32 bg_color;
-    __u8  depth;        Depth of the image
-    const char *data;   Pointer to image data
-    struct fb_cmap cmap;    color map info 
-};
-*/
-/* 1bit blit acceleration - this part is broken and will crash the machine */
+static DEVICE_ATTR(bitblt_stats, S_IRUGO | S_IWUSR,
+		s1d13xxxfb_bitblt_stats_show, s1d13xxxfb_bitblt_stats_store);
+
+/************************************************************
+ ink layer
+ ************************************************************/
+
 static void
-s1d13xxxfb_bitblt_imageblit_1(struct fb_info *info, const struct fb_image *image)
+s1d13xxxfb_ink_get(struct fb_info *info, struct s1dfb_ink *ink)
 {
-	u32 dst, nwords;
-	u8  tmp;
-	u32 stride, fgcolor, bgcolor;
-	u16 dx = image->dx, dy = image->dy;
-	u16 width = image->width, height = image->height;
-	u16 bpp, data;
-	u16 *pd;
-	u16 h;
-	volatile u8 status;
-
-	/*
-	 * Hardcode values so we see whats going on
-	 */
-	dx=0;
-	dy=0;
-	width=16;
-	height=1;
-	bgcolor=0x0000;
-	fgcolor=0xffff;
-	// EOH
+	struct s1d13xxxfb_par *par = info->par;
 
+	memset(ink, 0, sizeof(*ink));
+	ink->enable = par->ink_on;
+	ink->color0 = par->ink_color[0];
+	ink->color1 = par->ink_color[1];
+	ink->width = info->var.xres;
+	ink->height = info->var.yres;
+	ink->pitch = info->var.xres / 4;
+	ink->size = par->ink_size;
+}
 
-	// Find out bg / fg color
-	/*if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
-	    info->fix.visual == FB_VISUAL_DIRECTCOLOR) {
-		fgcolor = ((u32 *) (info->pseudo_palette))[image->fg_color];
-		bgcolor = ((u32 *) (info->pseudo_palette))[image->bg_color];
+/**
+ *	s1d13xxxfb_ink_set - switches the Ink/Cursor unit between ink and cursor
+ *	@info : framebuffer structure
+ *	@ink  : enable and colors, the rest is ignored
+ *
+ *	The ink plane covers the cursor image, so the cursor is uploaded
+ *	again when fbcon gets the unit back.
+ */
+static void
+s1d13xxxfb_ink_set(struct fb_info *info, const struct s1dfb_ink *ink)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	/* keep fbcon's cursor out while we switch */
+	spin_lock(&s1d13xxxfb_cursor_lock);
+
+	par->ink_color[0] = ink->color0;
+	par->ink_color[1] = ink->color1;
+	cursor_set_rgb(par, S1DREG_LCD_CUR_BCTL0, par->ink_color[0]);
+	cursor_set_rgb(par, S1DREG_LCD_CUR_BCTL1, par->ink_color[1]);
+
+	if (ink->enable && !par->ink_on) {
+		s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_START),
+				par->ink_size / 8192);
+		s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_CTL),
+				S1D_CUR_CTL_INK);
+		par->ink_on = 1;
+		par->cursor_on = 0;
+		par->cursor_valid = 0;
+	} else if (!ink->enable && par->ink_on) {
+		s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_CTL),
+				S1D_CUR_CTL_OFF);
+		s1d13xxxfb_writereg(par, cursor_reg(par, S1DREG_LCD_CUR_START), 0);
+		par->ink_on = 0;
+	}
+
+	spin_unlock(&s1d13xxxfb_cursor_lock);
+}
+
+/* fills the visible part of the ink plane with one pixel value */
+static void
+s1d13xxxfb_ink_clear(struct fb_info *info, u32 pixel)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 dest = par->vram_size - par->ink_size;
+	u32 pitch = info->var.xres / 4;
+	u8 val = pixel * 0x55;
+
+	if (par->prod_id == S1D13506_PROD_ID &&
+	    !(info->flags & FBINFO_HWACCEL_DISABLED)) {
+		bltbit_fill_linear(info, dest, pitch * info->var.yres, val * 0x0101);
 	} else {
-		fgcolor = image->fg_color;
-		bgcolor = image->bg_color;
-	}*/
+		s1d13xxxfb_sync_sleep(info);
+		memset_io(par->vram + dest, val, pitch * info->var.yres);
+	}
+}
 
-	// In 1bit we might run into an uneven number of bytes,
-	// so the last word will be incomplete
-	// not sure if this will be an issue
-	// pd = (u16*)image->data;
+/************************************************************
+ userspace BitBLT batches
+ ************************************************************/
 
-	/* bytes per xres line */
-	bpp = (info->var.bits_per_pixel >> 3);
-	stride = bpp * info->var.xres;
+/* lines of write and expand data are gathered here, the engine can't wait for page faults */
+#define S1D_BLT_BOUNCE_SIZE	16384
 
-	/* 1) Calculate destination address in screen memory */
-	dst = ((dy * stride) + (bpp * dx));
+/* the rectangle is inside the virtual screen and the engine limits */
+static int
+s1d13xxxfb_blt_check(struct fb_info *info, u32 x, u32 y, u32 width, u32 height,
+			u32 max_height)
+{
+	if (width > 1024 || height > max_height)
+		return -EINVAL;
+	if (width > info->var.xres_virtual || x > info->var.xres_virtual - width)
+		return -EINVAL;
+	if (height > info->var.yres_virtual || y > info->var.yres_virtual - height)
+		return -EINVAL;
+	if ((y + height) * info->fix.line_length > info->fix.smem_len)
+		return -EINVAL;
+	return 0;
+}
 
-	/* wait for engine to be free */
-	spin_lock(&s1d13xxxfb_bitblt_lock);
+/**
+ *	s1d13xxxfb_blt_gather - copies lines of user data into the bounce buffer
+ *	@par    : driver private data
+ *	@src    : first line
+ *	@pitch  : bytes between user lines
+ *	@lbytes : bytes per line, they end up packed
+ *	@lines  : number of lines
+ */
+static int
+s1d13xxxfb_blt_gather(struct s1d13xxxfb_par *par, const u8 __user *src,
+			u32 pitch, u32 lbytes, u32 lines)
+{
+	u32 y;
 
-	/* 2) set destination address */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START0, (dst & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START1, (dst >> 8) & 0x00ff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START2, (dst >> 16) & 0x00ff);
+	if (pitch == lbytes)
+		return copy_from_user(par->blt_bounce, src, lines * lbytes) ? -EFAULT : 0;
 
-	/* 3) program width */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH0, (width & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH1, (width >> 8));
+	for (y = 0; y < lines; y++, src += pitch)
+		if (copy_from_user(par->blt_bounce + y * lbytes, src, lbytes))
+			return -EFAULT;
+	return 0;
+}
 
-	/* 4) program height */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT0, (height & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT1, (height >> 8));
+static int
+s1d13xxxfb_blt_write(struct fb_info *info, const struct s1dfb_blt_op *op,
+			u8 rop, int key)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	const u8 __user *src = (const u8 __user *)(unsigned long)op->data;
+	u32 dx = op->dx, width = op->width;
+	u32 lbytes, lines, y, n;
+	int err;
+
+	/* 4bpp is written as bytes */
+	if (info->var.bits_per_pixel == 4) {
+		if ((dx | width) & 1)
+			return -EINVAL;
+		dx >>= 1;
+		width >>= 1;
+	}
 
-	/* 5) set source address to data alignment (word?) */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_SRC_START0, 0x00);  // Start with expanding the low byte
+	lbytes = width * bltbit_bytespp(info);
+	if (op->pitch < lbytes)
+		return -EINVAL;
+	lines = S1D_BLT_BOUNCE_SIZE / lbytes;
+
+	for (y = 0; y < op->height; y += n) {
+		n = min(lines, op->height - y);
+		err = s1d13xxxfb_blt_gather(par, src + y * op->pitch, op->pitch, lbytes, n);
+		if (err)
+			return err;
+
+		spin_lock(&s1d13xxxfb_bitblt_lock);
+		s1d13xxxfb_bitblt_writeblit(info, dx, op->dy + y, width, n,
+				par->blt_bounce, lbytes, rop, key);
+		spin_unlock(&s1d13xxxfb_bitblt_lock);
+	}
 
-	/* 6) program color expand blit */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_OP, 0x08);     // Color expand
+	return 0;
+}
 
-	/* 7) program ROP Code start pixel */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CC_EXP, 0x07); // Start from bit 7
+static int
+s1d13xxxfb_blt_expand(struct fb_info *info, const struct s1dfb_blt_op *op,
+			int transparent)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	const u8 __user *src = (const u8 __user *)(unsigned long)op->data;
+	u32 lbytes = DIV_ROUND_UP(op->width, 8);
+	u32 lines = S1D_BLT_BOUNCE_SIZE / lbytes;
+	struct fb_image image;
+	u32 y, n;
+	int err;
+
+	if (op->pitch < lbytes)
+		return -EINVAL;
 
-	/* 8) Program background color */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_BGC0, (bgcolor & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_BGC0, (bgcolor >> 8) & 0x00ff);
+	for (y = 0; y < op->height; y += n) {
+		n = min(lines, op->height - y);
+		err = s1d13xxxfb_blt_gather(par, src + y * op->pitch, op->pitch, lbytes, n);
+		if (err)
+			return err;
+
+		if (info->var.bits_per_pixel != 4) {
+			bltbit_expand(info, op->dx, op->dy + y, op->width, n,
+					par->blt_bounce, lbytes, op->fg, op->bg,
+					transparent);
+			continue;
+		}
 
-	/* 9) Program foreground color */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_FGC0, (fgcolor & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_FGC0, (fgcolor >> 8) & 0x00ff);
+		/* 4bpp, packed by the CPU */
+		memset(&image, 0, sizeof(image));
+		image.dx = op->dx;
+		image.dy = op->dy + y;
+		image.width = op->width;
+		image.height = n;
+		image.fg_color = op->fg;
+		image.bg_color = op->bg;
+		image.depth = 1;
+		image.data = (const char *)par->blt_bounce;
+		s1d13xxxfb_bitblt_imageblit(info, &image);
+	}
 
-	/* 10) setup the bpp 1 = 16bpp, 0 = 8bpp*/
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL1, 0x01);
-	// s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+	return 0;
+}
 
-	/* 11) set words per xres */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF0, (stride >> 1) & 0xff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF1, (stride >> 9));
+static int
+s1d13xxxfb_blt_pattern(struct fb_info *info, const struct s1dfb_blt_op *op,
+			u8 rop, int key)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 dx = op->dx, width = op->width;
 
-	/* 12) calculate #words for the bitblt engine */
-	nwords = ((width+15)/16) * height;
+	if (!par->pattern_offset)
+		return -EOPNOTSUPP;
 
-	/* 13) Program dest/src linear select bits for rectangle blit */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x0);
+	/* 4bpp patterns are 8 bytes wide */
+	if (info->var.bits_per_pixel == 4) {
+		if ((dx | width) & 1)
+			return -EINVAL;
+		dx >>= 1;
+		width >>= 1;
+	}
 
-	/* initialize the engine */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x80);
+	if (copy_from_user(par->blt_bounce, (const void __user *)(unsigned long)op->data,
+			64 * bltbit_bytespp(info)))
+		return -EFAULT;
 
-	/* 14) wait to start */
-	bltbit_wait_bitset(info, 0x80);
-
-	/* Write nwords to blt-fifo */
-	/*     Check fifo status bit4=0 */
-	/*       128            64               32            16         8    4       2             1     */
-	/*         7             6                5             4         3    2       1             0     */
-	/*     bltActive | Fifo not empty | FiFo half full | FiFo full | na | na | dst linear | src linear */
-	/*
-	 *                       0                0             0     --> write 1 word
-	 *                       1                0             0     --> write 0 words
-	 *                       1                1             0     --> write 0 words
-	 *                       1                1             1     --> dont write
-	 *     0x10 - full bit
-	 *     0x20 - half full bit
-	 *     0x40 - not empty bit
-	 */
-	for (h=0;h<height;h++) {
-		// Wait for the FIFO to empty
-		do {
-			status = s1d13xxxfb_readreg(info->par, S1DREG_BBLT_CTL0);
-		} while((status & 0x10));
-		
-		// now write 1 words
-		data=0x0f0f; // Should give us a checkerboard
-		s1d13xxxfb_writeregw(info->par, S1DREG_BBLT_DATA0+(h<<1), data);
-		
-		do {
-			status = s1d13xxxfb_readreg(info->par, S1DREG_BBLT_CTL0);
-		} while((status & 0x40));
-	}
-
-	/* Wait for blit to finsh */
-	bltbit_wait_bitclear(info, 0x80);
-	spin_unlock(&s1d13xxxfb_bitblt_lock);
+	bltbit_pattern(info, dx, op->dy, width, op->height, par->blt_bounce, 0, rop, key);
+	return 0;
 }
 
-/* 16bit blit acceleration */
-static void
-s1d13xxxfb_bitblt_imageblit_16(struct fb_info *info, const struct fb_image *image)
+static int
+s1d13xxxfb_blt_fill(struct fb_info *info, const struct s1dfb_blt_op *op, u8 rop)
 {
-	u32 dst, nwords;
-	u8  tmp;
-	u32 stride;
-	u16 dx = image->dx, dy = image->dy;
-	u16 width = image->width, height = image->height;
-	u16 bpp, data;
-	u16 *pd;
-	u8 status;
+	struct s1d13xxxfb_par *par = info->par;
+	u32 stride = info->fix.line_length;
+	u32 dx = op->dx, width = op->width;
+	u32 fg = op->fg;
+	struct fb_fillrect rect;
+
+	if (rop == BBLT_ROP_COPY && info->var.bits_per_pixel == 16) {
+		if (width * 2 == stride)
+			bltbit_fill_linear(info, op->dy * stride, op->height * stride, fg);
+		else
+			bltbit_fill(info, op->dy * stride + dx * 2,
+					width, op->height, stride, fg, 2);
+		return 0;
+	}
 
-	// In 16 bit this will always be an even number of bytes to blit
-	pd = (u16*)image->data;
+	/* palette modes, pixel values are palette indices */
+	if (rop == BBLT_ROP_COPY) {
+		rect.dx = dx;
+		rect.dy = op->dy;
+		rect.width = width;
+		rect.height = op->height;
+		rect.color = fg;
+		rect.rop = ROP_COPY;
+		s1d13xxxfb_bitblt_solidfill(info, &rect);
+		return 0;
+	}
 
-	/* bytes per xres line */
-	bpp = (info->var.bits_per_pixel >> 3);
-	stride = bpp * info->var.xres;
+	/* the other ROPs take a solid pattern as source */
+	if (!par->pattern_offset)
+		return -EOPNOTSUPP;
+	if (info->var.bits_per_pixel == 4) {
+		if ((dx | width) & 1)
+			return -EINVAL;
+		dx >>= 1;
+		width >>= 1;
+		fg = (fg & 0x0f) * 0x11;
+	}
 
-	/* 1) Calculate destination address in screen memory */
-	dst = ((dy * stride) + (bpp * dx));
+	bltbit_pattern(info, dx, op->dy, width, op->height, NULL, fg, rop, BBLT_NO_KEY);
+	return 0;
+}
 
-	// wait for engine to be free
-	spin_lock(&s1d13xxxfb_bitblt_lock);
+static int
+s1d13xxxfb_blt_copy(struct fb_info *info, const struct s1dfb_blt_op *op,
+			u8 rop, int key)
+{
+	struct fb_copyarea area;
+	u32 sx = op->sx, dx = op->dx, width = op->width;
+	int err;
+
+	err = s1d13xxxfb_blt_check(info, sx, op->sy, width, op->height, 1024);
+	if (err)
+		return err;
+
+	if (info->var.bits_per_pixel == 4) {
+		if ((sx | dx | width) & 1) {
+			/* cfb_copyarea can do the plain copy */
+			if (rop != BBLT_ROP_COPY || key != BBLT_NO_KEY)
+				return -EINVAL;
+			area.sx = sx;
+			area.sy = op->sy;
+			area.dx = dx;
+			area.dy = op->dy;
+			area.width = width;
+			area.height = op->height;
+			s1d13xxxfb_bitblt_copyarea(info, &area);
+			return 0;
+		}
+		sx >>= 1;
+		dx >>= 1;
+		width >>= 1;
+	}
 
-	/* set destination address */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START0, (dst & 0xff));
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START1, (dst >> 8) & 0x00ff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_DST_START2, (dst >> 16) & 0x00ff);
+	return bltbit_move(info, sx, op->sy, dx, op->dy, width, op->height, rop, key);
+}
+
+static int
+s1d13xxxfb_blt_run(struct fb_info *info, const struct s1dfb_blt_op *op)
+{
+	u32 max_height = 1024;
+	u8 rop = BBLT_ROP_COPY;
+	int key = BBLT_NO_KEY;
+	int err;
+
+	if (op->flags & ~S1DFB_BLT_TRANSPARENT)
+		return -EINVAL;
+	if (op->rop) {
+		if ((op->rop & ~0x0f) != S1DFB_ROP(0))
+			return -EINVAL;
+		rop = op->rop & 0x0f;
+	}
 
-	/* 2) program width */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH0, (width & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_WIDTH1, (width >> 8));
+	/* the transparent blits have no ROP, the engine compares 4bpp pixels in pairs */
+	if (op->flags & S1DFB_BLT_TRANSPARENT) {
+		if (rop != BBLT_ROP_COPY || op->op == S1DFB_BLT_FILL)
+			return -EINVAL;
+		if (info->var.bits_per_pixel == 4)
+			return -EOPNOTSUPP;
+		key = op->bg & 0xffff;
+	}
+	if (op->op == S1DFB_BLT_EXPAND && rop != BBLT_ROP_COPY)
+		return -EINVAL;
+
+	if (!op->width || !op->height)
+		return 0;
 
-	/* 3) program height */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT0, (height & 0xff) - 1);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_HEIGHT1, (height >> 8));
+	/* whole lines are filled in the linear mode, any number of them */
+	if (op->op == S1DFB_BLT_FILL && rop == BBLT_ROP_COPY &&
+	    !op->dx && op->width == info->var.xres_virtual)
+		max_height = info->var.yres_virtual;
+
+	err = s1d13xxxfb_blt_check(info, op->dx, op->dy, op->width, op->height, max_height);
+	if (err)
+		return err;
+
+	switch (op->op) {
+	case S1DFB_BLT_FILL:
+		return s1d13xxxfb_blt_fill(info, op, rop);
+	case S1DFB_BLT_COPY:
+		return s1d13xxxfb_blt_copy(info, op, rop, key);
+	case S1DFB_BLT_WRITE:
+		return s1d13xxxfb_blt_write(info, op, rop, key);
+	case S1DFB_BLT_EXPAND:
+		return s1d13xxxfb_blt_expand(info, op, key != BBLT_NO_KEY);
+	case S1DFB_BLT_PATTERN:
+		return s1d13xxxfb_blt_pattern(info, op, rop, key);
+	}
 
-	/* 4) set source address to data alignment (word?) */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_SRC_START0, 0x00);
+	return -EINVAL;
+}
 
-	/* 5) program ROP WriteBlt */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_OP, 0x00);
+/**
+ *	s1d13xxxfb_blt_batch - S1DFB_IOC_BLIT
+ *	@info   : framebuffer structure
+ *	@ubatch : the batch in user memory
+ *
+ *	The fb core holds info->lock around the whole batch, the ops are
+ *	copied in with one copy_from_user. Stops at the first bad operation,
+ *	done tells how far we got.
+ *
+ *	Returns negative errno on error, or zero on success.
+ */
+static int
+s1d13xxxfb_blt_batch(struct fb_info *info, struct s1dfb_blt_batch __user *ubatch)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1dfb_blt_batch batch;
+	struct s1dfb_blt_op *ops;
+	int i, err = 0;
 
-	/* 6) program ROP Code dest=source */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CC_EXP, 0x0c);
+	if (par->prod_id != S1D13506_PROD_ID ||
+	    (info->flags & FBINFO_HWACCEL_DISABLED))
+		return -ENODEV;
+#ifdef CONFIG_FB_DEFERRED_IO
+	/* the screen is in the shadow, VRAM gets overwritten from there */
+	if (par->shadow)
+		return -EBUSY;
+#endif
 
-	/* 7) setup the bpp 1 = 16bpp, 0 = 8bpp*/
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL1, (bpp >> 1));
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count > S1DFB_BLT_MAX_OPS)
+		return -EINVAL;
+	if (!batch.count)
+		return 0;
 
-	/* 8) set words per xres */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF0, (stride >> 1) & 0xff);
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_MEM_OFF1, (stride >> 9));
+	if (!par->blt_bounce) {
+		par->blt_bounce = kmalloc(S1D_BLT_BOUNCE_SIZE, GFP_KERNEL);
+		if (!par->blt_bounce)
+			return -ENOMEM;
+	}
 
-	/* 9) calculate #words for the bitblt engine */
-	/*    nwords = ((width+1+sourcephase)/2) * height */
-	nwords = ((width+1)>>1) * height;
+	ops = kmalloc(batch.count * sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+	if (copy_from_user(ops, (void __user *)(unsigned long)batch.ops,
+			batch.count * sizeof(*ops))) {
+		kfree(ops);
+		return -EFAULT;
+	}
 
-	/* 10) Program dest/src linear select bits for rectangle blit */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x0);
+	for (i = 0; i < batch.count; i++) {
+		err = s1d13xxxfb_blt_run(info, &ops[i]);
+		if (err)
+			break;
+	}
+	kfree(ops);
 
-	/* initialize the engine */
-	s1d13xxxfb_writereg(info->par, S1DREG_BBLT_CTL0, 0x80);
+	if (batch.flags & S1DFB_BLT_BATCH_SYNC)
+		s1d13xxxfb_sync_sleep(info);
 
-	/* wait for  engine to startup */
-	bltbit_wait_bitset(info, 0x80);
-
-	/* 11) write nwords to blt-fifo */
-	/*     Check fifo status bit4=0 */
-	/*       128            64               32            16         8    4       2             1     */
-	/*         7             6                5             4         3    2       1             0     */
-	/*     bltActive | Fifo not empty | FiFo half full | FiFo full | na | na | dst linear | src linear */
-	/*
-	 *                       0                0             0     --> write 16 words
-	 *                       1                0             0     --> write 8 words
-	 *                       1                1             0     --> write 1..7 words
-	 *                       1                1             1     --> dont write
-	 *     0x10 - full bit
-	 *     0x20 - half full bit
-	 *     0x40 - not empty bit
-	 */
-	while(nwords>0) {
-		/* wait for fifo not to be full (not using the bitclear here because we need status */
-		do {
-			status = s1d13xxxfb_readreg(info->par, S1DREG_BBLT_CTL0);
-		} while(status & 0x10);
-
-		// Determine how much we can write
-		if (status & 0x20) {  // Half full, write 7 words max
-			tmp = 7;
-		} else {
-			if (status & 0x40) {  // not empty, write 8 words
-				tmp = 8;
-			} else {
-				tmp = 16;     // empty write 16 words
-			}
-		}
+	if (put_user(i, &ubatch->done))
+		return -EFAULT;
+	return err;
+}
 
-		while (tmp>0 && nwords>0) {
-			data = *(pd++);
-			s1d13xxxfb_writeregw(info->par, S1DREG_BBLT_DATA0, data);
-			tmp--;
-			nwords--;
-		}
+static int
+s1d13xxxfb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	void __user *argp = (void __user *)arg;
+	struct s1dfb_ink ink;
+	struct fb_vblank vblank;
+	u32 val;
+
+	switch (cmd) {
+	case FBIO_WAITFORVSYNC:
+		if (get_user(val, (u32 __user *)argp))
+			return -EFAULT;
+		if (val != 0)
+			return -ENODEV;
+		return s1d13xxxfb_wait_vblank(info, 1);
+	case FBIOGET_VBLANK:
+		memset(&vblank, 0, sizeof(vblank));
+		vblank.flags = FB_VBLANK_HAVE_VBLANK;
+		if (s1d13xxxfb_in_vblank(par))
+			vblank.flags |= FB_VBLANK_VBLANKING;
+		return copy_to_user(argp, &vblank, sizeof(vblank)) ? -EFAULT : 0;
+	case S1DFB_IOC_INK_GET:
+		if (!par->ink_size)
+			return -ENODEV;
+		s1d13xxxfb_ink_get(info, &ink);
+		return copy_to_user(argp, &ink, sizeof(ink)) ? -EFAULT : 0;
+	case S1DFB_IOC_INK_SET:
+		if (!par->ink_size)
+			return -ENODEV;
+		if (copy_from_user(&ink, argp, sizeof(ink)))
+			return -EFAULT;
+		s1d13xxxfb_ink_set(info, &ink);
+		return 0;
+	case S1DFB_IOC_BLIT:
+		return s1d13xxxfb_blt_batch(info, argp);
+	case S1DFB_IOC_INK_CLEAR:
+		if (!par->ink_size)
+			return -ENODEV;
+		if (get_user(val, (u32 __user *)argp))
+			return -EFAULT;
+		if (val > S1DFB_INK_INVERT)
+			return -EINVAL;
+		s1d13xxxfb_ink_clear(info, val);
+		return 0;
 	}
 
-	/* Wait for blit to finish */
-	bltbit_wait_bitclear(info, 0x80);
-	spin_unlock(&s1d13xxxfb_bitblt_lock);
+	return -ENOTTY;
 }
 
-static void
-s1d13xxxfb_bitblt_imageblit(struct fb_info *info, const struct fb_image *image)
+/**
+ *	s1d13xxxfb_mmap - maps the framebuffer or the ink plane
+ *	@info : framebuffer structure
+ *	@vma  : the mapping
+ *
+ *	S1DFB_INK_MMAP_OFFSET selects the ink plane, anything else is
+ *	handled like fb_mmap() does. With a shadow, fb_deferred_io maps
+ *	the framebuffer part and the registers behind it stay ours.
+ */
+static int
+s1d13xxxfb_mmap(struct fb_info *info, struct vm_area_struct *vma)
 {
-        if (info->state != FBINFO_STATE_RUNNING)
-        return;
+	struct s1d13xxxfb_par *par = info->par;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long start = info->fix.smem_start;
+	u32 len = info->fix.smem_len;
 
-	// Call SW impl if acceleration is disabled
-	if (info->flags & FBINFO_HWACCEL_DISABLED) {
-		cfb_imageblit(info, image);
-		return;
-	}
-	
-	// The below is only implemented for 16bit-per-pixel framebuffers (HP Jornada)
-	// Use software implementation for other bitdepths
-	if (info->var.bits_per_pixel!=16) {
-		cfb_imageblit(info, image);
-		return;
+	if (off == S1DFB_INK_MMAP_OFFSET) {
+		if (!par->ink_size)
+			return -EINVAL;
+		vma->vm_pgoff = 0;
+		start += par->vram_size - par->ink_size;
+		len = par->ink_size;
+	} else if (off >= PAGE_ALIGN(len)) {
+		/* the registers follow the framebuffer */
+		vma->vm_pgoff -= PAGE_ALIGN(len) >> PAGE_SHIFT;
+		start = info->fix.mmio_start;
+		len = info->fix.mmio_len;
+#ifdef CONFIG_FB_DEFERRED_IO
+	} else if (par->defio_mmap) {
+		return par->defio_mmap(info, vma);
+#endif
 	}
 
-	// Depending on bit depth of the fb_image, different logic is needed
-	// 1bit:  text console -> color expand blit
-	// 16bit: GUIs         -> write blit
-	// others: fallback to software impl.
-	switch (image->depth) {
-	case 1:
-		// Call 1bit implementation - broken
-		// s1d13xxxfb_bitblt_imageblit_1(info, image);
-		cfb_imageblit(info, image);
-		return;
-	case 16:
-		// Call 16bit implementation
-		s1d13xxxfb_bitblt_imageblit_16(info, image);
-		return;
-	default:
-		cfb_imageblit(info, image);
-		return;
-	}
+	vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+	return vm_iomap_memory(vma, start, len);
 }
 
 /* framebuffer information structures */
 static struct fb_ops s1d13xxxfb_fbops = {
 	.owner		= THIS_MODULE,
+	.fb_check_var	= s1d13xxxfb_check_var,
 	.fb_set_par	= s1d13xxxfb_set_par,
 	.fb_setcolreg	= s1d13xxxfb_setcolreg,
 	.fb_blank	= s1d13xxxfb_blank,
 
 	.fb_pan_display	= s1d13xxxfb_pan_display,
+	.fb_sync	= s1d13xxxfb_sync,
+	.fb_ioctl	= s1d13xxxfb_ioctl,
+	.fb_mmap	= s1d13xxxfb_mmap,
 
 	/* gets replaced at chip detection time */
 	.fb_fillrect	= cfb_fillrect,
@@ -1004,10 +3456,14 @@ static void s1d13xxxfb_fetch_hw_state(struct fb_info *info)
 
 	switch (bpp) {
 		case 2:	/* 4 bpp */
+			var->bits_per_pixel = 4;
+			var->red.offset = var->green.offset = var->blue.offset = 0;
+			s1d13xxxfb_setup_pseudocolour(info);
+			break;
 		case 3:	/* 8 bpp */
 			var->bits_per_pixel = 8;
 			var->red.offset = var->green.offset = var->blue.offset = 0;
-			var->red.length = var->green.length = var->blue.length = 8;
+			s1d13xxxfb_setup_pseudocolour(info);
 			break;
 		case 5:	/* 16 bpp */
 			s1d13xxxfb_setup_truecolour(info);
@@ -1062,9 +3518,407 @@ static void s1d13xxxfb_fetch_hw_state(struct fb_info *info)
 		xres, yres, xres_virtual, yres_virtual, is_color, is_dual, is_tft);
 }
 
+#if defined(CONFIG_PM) || defined(CONFIG_DEBUG_FS)
+/************************************************************
+ VRAM copies
+
+ memcpy_fromio/toio go byte by byte on ARM, so VRAM is copied in
+ words and ldm/stm bursts.
+ ************************************************************/
+
+/* 16 bytes with one ldm/stm pair, both sides 32bit aligned */
+static inline void
+s1d13xxxfb_move16(void *dst, const void *src)
+{
+#ifdef CONFIG_ARM
+	__asm__ __volatile__(
+		"ldmia	%0, {r4-r7}\n\t"
+		"stmia	%1, {r4-r7}\n\t"
+		:
+		: "r" (src), "r" (dst)
+		: "r4", "r5", "r6", "r7", "memory");
+#else
+	memcpy(dst, src, 16);
+#endif
+}
+
+/* even number of bytes from 16bit aligned VRAM */
+static void
+s1d13xxxfb_burst_fromio(u8 *dst, const u8 __iomem *src, u32 bytes)
+{
+	if (((unsigned long)src & 2) && bytes) {
+		*(u16 *)dst = __raw_readw(src);
+		dst += 2;
+		src += 2;
+		bytes -= 2;
+	}
+
+	if (!((unsigned long)dst & 2)) {
+		for (; bytes >= 16; dst += 16, src += 16, bytes -= 16)
+			s1d13xxxfb_move16(dst, (const void __force *)src);
+		for (; bytes >= 4; dst += 4, src += 4, bytes -= 4)
+			*(u32 *)dst = __raw_readl(src);
+	}
+
+	for (; bytes; dst += 2, src += 2, bytes -= 2)
+		*(u16 *)dst = __raw_readw(src);
+}
+
+/* even number of bytes to 16bit aligned VRAM */
+static void
+s1d13xxxfb_burst_toio(u8 __iomem *dst, const u8 *src, u32 bytes)
+{
+	if (((unsigned long)dst & 2) && bytes) {
+		__raw_writew(*(const u16 *)src, dst);
+		dst += 2;
+		src += 2;
+		bytes -= 2;
+	}
+
+	if (!((unsigned long)src & 2)) {
+		for (; bytes >= 16; dst += 16, src += 16, bytes -= 16)
+			s1d13xxxfb_move16((void __force *)dst, src);
+		for (; bytes >= 4; dst += 4, src += 4, bytes -= 4)
+			__raw_writel(*(const u32 *)src, dst);
+	}
+
+	for (; bytes; dst += 2, src += 2, bytes -= 2)
+		__raw_writew(*(const u16 *)src, dst);
+}
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+/************************************************************
+ acceleration benchmark
+
+ Writing to /sys/kernel/debug/s1d13xxxfb/bench runs fill, copy
+ (overlapping, forward and backward) and 1bpp imageblit through the
+ BitBLT engine and through cfb_* at a sweep of sizes in 4, 8 and
+ 16bpp; reading it shows the table of the last run. The depths are
+ run on a bare fb_info with the fields the blit paths and cfb_* read,
+ drawing to the top of VRAM, which is saved and put back afterwards.
+ Takes a few seconds, the console is locked meanwhile.
+ ************************************************************/
+
+#define S1D_BENCH_MIN_NS	(10 * NSEC_PER_MSEC)	/* per measurement */
+#define S1D_BENCH_MIN_RUNS	4
+#define S1D_BENCH_MAX_RUNS	(1 << 16)
+#define S1D_BENCH_SHIFT		4	/* pixels between source and destination of the copies */
+#define S1D_BENCH_BUF		12288
+
+enum {
+	S1D_BENCH_FILL,
+	S1D_BENCH_COPY_FWD,
+	S1D_BENCH_COPY_REV,
+	S1D_BENCH_IMAGE,
+	S1D_BENCH_NR_OPS,
+};
+
+static const char *s1d13xxxfb_bench_names[S1D_BENCH_NR_OPS] = {
+	"fill",
+	"copy fwd",
+	"copy rev",
+	"image",
+};
+
+static const u32 s1d13xxxfb_bench_sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128, 224 };
+static const u32 s1d13xxxfb_bench_depths[] = { 4, 8, 16 };
+
+/* one operation, through the engine or cfb_* */
+static void
+s1d13xxxfb_bench_op(struct fb_info *bi, int op, u32 size, int hw, const u8 *bitmap)
+{
+	struct fb_fillrect rect;
+	struct fb_copyarea area;
+	struct fb_image image;
+
+	switch (op) {
+	case S1D_BENCH_FILL:
+		rect.dx = rect.dy = 0;
+		rect.width = rect.height = size;
+		rect.color = 7;
+		rect.rop = ROP_COPY;
+		if (hw)
+			s1d13xxxfb_bitblt_solidfill(bi, &rect);
+		else
+			cfb_fillrect(bi, &rect);
+		break;
+	case S1D_BENCH_COPY_FWD:
+	case S1D_BENCH_COPY_REV:
+		area.width = area.height = size;
+		area.sx = area.sy = (op == S1D_BENCH_COPY_FWD) ? S1D_BENCH_SHIFT : 0;
+		area.dx = area.dy = (op == S1D_BENCH_COPY_FWD) ? 0 : S1D_BENCH_SHIFT;
+		if (hw)
+			s1d13xxxfb_bitblt_copyarea(bi, &area);
+		else
+			cfb_copyarea(bi, &area);
+		break;
+	case S1D_BENCH_IMAGE:
+		memset(&image, 0, sizeof(image));
+		image.width = image.height = size;
+		image.fg_color = 7;
+		image.depth = 1;
+		image.data = (const char *)bitmap;
+		if (hw)
+			s1d13xxxfb_bitblt_imageblit(bi, &image);
+		else
+			cfb_imageblit(bi, &image);
+		break;
+	}
+}
+
+/* the engine moves whole bytes in 4bpp, odd widths are drawn by cfb_* */
+static inline int
+s1d13xxxfb_bench_engine(u32 bpp, u32 size)
+{
+	return bpp != 4 || !(size & 1);
+}
+
+/* ns per operation, including the wait for the engine at the end */
+static u64
+s1d13xxxfb_bench_time(struct fb_info *bi, int op, u32 size, int hw, const u8 *bitmap)
+{
+	ktime_t start;
+	s64 ns;
+	u32 runs, i;
+
+	/* double the runs until the clock has something to measure */
+	for (runs = S1D_BENCH_MIN_RUNS; ; runs <<= 1) {
+		s1d13xxxfb_sync(bi);
+		start = ktime_get();
+		for (i = 0; i < runs; i++)
+			s1d13xxxfb_bench_op(bi, op, size, hw, bitmap);
+		s1d13xxxfb_sync(bi);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		if (ns >= S1D_BENCH_MIN_NS || runs >= S1D_BENCH_MAX_RUNS)
+			break;
+		cond_resched();
+	}
+
+	return div_u64(max_t(s64, ns, 1), runs);
+}
 
+/* pixels per ns in MPix/s with one decimal */
 static int
-s1d13xxxfb_remove(struct platform_device *pdev)
+s1d13xxxfb_bench_rate(char *buf, size_t len, u32 pixels, u64 ns)
+{
+	u64 rate = div_u64((u64)pixels * 10000, ns);
+
+	return scnprintf(buf, len, " %6llu.%llu", div_u64(rate, 10),
+			rate - div_u64(rate, 10) * 10);
+}
+
+static int
+s1d13xxxfb_bench_run(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 cross[S1D_BENCH_NR_OPS][ARRAY_SIZE(s1d13xxxfb_bench_depths)];
+	u32 save_len, size, bpp;
+	u64 hw_ns, sw_ns;
+	struct fb_info *bi;
+	u8 *save, *bitmap;
+	char *out;
+	size_t len = 0;
+	int op, d, i;
+
+	if (par->prod_id != S1D13506_PROD_ID ||
+	    (info->flags & FBINFO_HWACCEL_DISABLED))
+		return -ENODEV;
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (par->shadow)
+		return -EBUSY;
+#endif
+	if (info->state != FBINFO_STATE_RUNNING)
+		return -EBUSY;
+
+	if (!par->bench_buf) {
+		par->bench_buf = kmalloc(S1D_BENCH_BUF, GFP_KERNEL);
+		if (!par->bench_buf)
+			return -ENOMEM;
+	}
+	out = par->bench_buf;
+
+	/* the lines the 16bpp run draws to */
+	save_len = min_t(u32, info->var.yres * info->var.xres * 2, info->fix.smem_len);
+	save = vmalloc(save_len);
+	bitmap = kmalloc(DIV_ROUND_UP(224, 8) * 224, GFP_KERNEL);
+	bi = kzalloc(sizeof(*bi), GFP_KERNEL);
+	if (!save || !bitmap || !bi) {
+		vfree(save);
+		kfree(bitmap);
+		kfree(bi);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < DIV_ROUND_UP(224, 8) * 224; i++)
+		bitmap[i] = i * 37;
+
+	s1d13xxxfb_sync(info);
+	s1d13xxxfb_burst_fromio(save, par->vram, save_len);
+
+	len += scnprintf(out + len, S1D_BENCH_BUF - len,
+		"%-8s %3s %7s %10s %10s %7s %7s\n",
+		"op", "bpp", "size", "hw ns", "cfb ns", "hw MP/s", "cfb");
+
+	for (d = 0; d < ARRAY_SIZE(s1d13xxxfb_bench_depths); d++) {
+		bpp = s1d13xxxfb_bench_depths[d];
+
+		/* same screen, another depth */
+		bi->par = par;
+		bi->fbops = info->fbops;
+		bi->flags = info->flags;
+		bi->state = FBINFO_STATE_RUNNING;
+		bi->screen_base = par->vram;
+		bi->pseudo_palette = info->pseudo_palette;
+		bi->var = info->var;
+		bi->fix = info->fix;
+		bi->var.bits_per_pixel = bpp;
+		bi->var.xres_virtual = info->var.xres;
+		bi->var.yres_virtual = info->var.yres;
+		bi->var.xoffset = bi->var.yoffset = 0;
+		bi->fix.line_length = info->var.xres * bpp / 8;
+		bi->fix.visual = (bpp == 16) ? FB_VISUAL_TRUECOLOR : FB_VISUAL_PSEUDOCOLOR;
+
+		for (op = 0; op < S1D_BENCH_NR_OPS; op++) {
+			cross[op][d] = 0;
+
+			for (i = 0; i < ARRAY_SIZE(s1d13xxxfb_bench_sizes); i++) {
+				size = s1d13xxxfb_bench_sizes[i];
+				if (size + S1D_BENCH_SHIFT > info->var.xres ||
+				    size + S1D_BENCH_SHIFT > info->var.yres)
+					break;
+
+				sw_ns = s1d13xxxfb_bench_time(bi, op, size, 0, bitmap);
+				if (!s1d13xxxfb_bench_engine(bpp, size)) {
+					len += scnprintf(out + len, S1D_BENCH_BUF - len,
+						"%-8s %3u %3ux%-3u %10s %10llu %8s",
+						s1d13xxxfb_bench_names[op], bpp, size, size,
+						"-", sw_ns, "-");
+					len += s1d13xxxfb_bench_rate(out + len, S1D_BENCH_BUF - len,
+						size * size, sw_ns);
+					len += scnprintf(out + len, S1D_BENCH_BUF - len, "\n");
+					continue;
+				}
+				hw_ns = s1d13xxxfb_bench_time(bi, op, size, 1, bitmap);
+
+				/* the size from which on the engine stays ahead */
+				if (hw_ns >= sw_ns)
+					cross[op][d] = 0;
+				else if (!cross[op][d])
+					cross[op][d] = size;
+
+				len += scnprintf(out + len, S1D_BENCH_BUF - len,
+					"%-8s %3u %3ux%-3u %10llu %10llu",
+					s1d13xxxfb_bench_names[op], bpp, size, size,
+					hw_ns, sw_ns);
+				len += s1d13xxxfb_bench_rate(out + len, S1D_BENCH_BUF - len,
+					size * size, hw_ns);
+				len += s1d13xxxfb_bench_rate(out + len, S1D_BENCH_BUF - len,
+					size * size, sw_ns);
+				len += scnprintf(out + len, S1D_BENCH_BUF - len, "\n");
+			}
+		}
+	}
+
+	s1d13xxxfb_sync(info);
+	s1d13xxxfb_burst_toio(par->vram, save, save_len);
+
+	len += scnprintf(out + len, S1D_BENCH_BUF - len, "\nengine faster from\n%-8s", "");
+	for (d = 0; d < ARRAY_SIZE(s1d13xxxfb_bench_depths); d++)
+		len += scnprintf(out + len, S1D_BENCH_BUF - len, " %7ubpp",
+			s1d13xxxfb_bench_depths[d]);
+	for (op = 0; op < S1D_BENCH_NR_OPS; op++) {
+		len += scnprintf(out + len, S1D_BENCH_BUF - len, "\n%-8s",
+			s1d13xxxfb_bench_names[op]);
+		for (d = 0; d < ARRAY_SIZE(s1d13xxxfb_bench_depths); d++) {
+			if (cross[op][d])
+				len += scnprintf(out + len, S1D_BENCH_BUF - len,
+					"    %3ux%-3u", cross[op][d], cross[op][d]);
+			else
+				len += scnprintf(out + len, S1D_BENCH_BUF - len,
+					" %10s", "never");
+		}
+	}
+	len += scnprintf(out + len, S1D_BENCH_BUF - len, "\n");
+	par->bench_len = len;
+
+	vfree(save);
+	kfree(bitmap);
+	kfree(bi);
+	return 0;
+}
+
+static ssize_t
+s1d13xxxfb_bench_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct fb_info *info = file->private_data;
+	struct s1d13xxxfb_par *par = info->par;
+
+	if (!par->bench_buf)
+		return 0;
+	return simple_read_from_buffer(buf, count, ppos, par->bench_buf, par->bench_len);
+}
+
+static ssize_t
+s1d13xxxfb_bench_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct fb_info *info = file->private_data;
+	int err;
+
+	/* same order as FBIOPUT_VSCREENINFO and FBIOPAN_DISPLAY: console first, then fb_info */
+	console_lock();
+	if (!lock_fb_info(info)) {
+		console_unlock();
+		return -ENODEV;
+	}
+	err = s1d13xxxfb_bench_run(info);
+	unlock_fb_info(info);
+	console_unlock();
+
+	return err ? err : count;
+}
+
+static const struct file_operations s1d13xxxfb_bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= s1d13xxxfb_bench_read,
+	.write		= s1d13xxxfb_bench_write,
+	.llseek		= default_llseek,
+};
+
+static void
+s1d13xxxfb_bench_init(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	par->debugfs = debugfs_create_dir("s1d13xxxfb", NULL);
+	if (IS_ERR_OR_NULL(par->debugfs)) {
+		par->debugfs = NULL;
+		return;
+	}
+	debugfs_create_file("bench", 0600, par->debugfs, info, &s1d13xxxfb_bench_fops);
+}
+
+static void
+s1d13xxxfb_bench_exit(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+
+	debugfs_remove_recursive(par->debugfs);
+	par->debugfs = NULL;
+	kfree(par->bench_buf);
+	par->bench_buf = NULL;
+}
+#else
+#define s1d13xxxfb_bench_init(info)
+#define s1d13xxxfb_bench_exit(info)
+#endif /* CONFIG_DEBUG_FS */
+
+
+/* frees everything probe set up, the framebuffer is not registered (anymore) */
+static int
+__s1d13xxxfb_remove(struct platform_device *pdev)
 {
 	struct fb_info *info = platform_get_drvdata(pdev);
 	struct s1d13xxxfb_par *par = NULL;
@@ -1072,8 +3926,19 @@ s1d13xxxfb_remove(struct platform_device *pdev)
 	// Powerdown before remove
 	s1d13xxxfb_blank(FB_BLANK_POWERDOWN, info);
 
+	device_remove_file(&pdev->dev, &dev_attr_bitblt_stats);
+#ifdef CONFIG_FB_DEFERRED_IO
+	device_remove_file(&pdev->dev, &dev_attr_shadow_stats);
+#endif
+
 	if (info) {
 		par = info->par;
+		if (par)
+			s1d13xxxfb_bench_exit(info);
+#ifdef CONFIG_FB_DEFERRED_IO
+		if (par)
+			s1d13xxxfb_shadow_exit(info);
+#endif
 		if (par && par->regs) {
 			/* disable output & enable powersave */
 			s1d13xxxfb_writereg(par, S1DREG_COM_DISP_MODE, 0x00);
@@ -1083,8 +3948,17 @@ s1d13xxxfb_remove(struct platform_device *pdev)
 
 		fb_dealloc_cmap(&info->cmap);
 
-		if (info->screen_base)
-			iounmap(info->screen_base);
+		if (par && par->vram)
+			iounmap(par->vram);
+		if (par)
+			kfree(par->blt_bounce);
+#ifdef CONFIG_PM
+		/* left over from a suspend that failed further down */
+		if (par) {
+			kfree(par->regs_save);
+			vfree(par->disp_save);
+		}
+#endif
 
 		framebuffer_release(info);
 	}
@@ -1096,6 +3970,18 @@ s1d13xxxfb_remove(struct platform_device *pdev)
 	return 0;
 }
 
+static int
+s1d13xxxfb_remove(struct platform_device *pdev)
+{
+	struct fb_info *info = platform_get_drvdata(pdev);
+
+	/* fbcon, mmap users and the deferred io work let go of the buffers first */
+	if (info)
+		unregister_framebuffer(info);
+
+	return __s1d13xxxfb_remove(pdev);
+}
+
 static int s1d13xxxfb_probe(struct platform_device *pdev)
 {
 	struct s1d13xxxfb_par *default_par;
@@ -1170,6 +4056,7 @@ static int s1d13xxxfb_probe(struct platform_device *pdev)
 		ret = -ENOMEM;
 		goto bail;
 	}
+	default_par->vram = info->screen_base;
 
 	/* production id is top 6 bits */
 	prod_id = s1d13xxxfb_readreg(default_par, S1DREG_REV_CODE) >> 2;
@@ -1204,6 +4091,7 @@ static int s1d13xxxfb_probe(struct platform_device *pdev)
 	info->fix.mmio_len = pdev->resource[1].end - pdev->resource[1].start + 1;
 	info->fix.smem_start = pdev->resource[0].start;
 	info->fix.smem_len = pdev->resource[0].end - pdev->resource[0].start + 1;
+	default_par->vram_size = info->fix.smem_len;
 
 	printk(KERN_INFO PFX "regs mapped at 0x%p, fb %d KiB mapped at 0x%p\n",
 	       default_par->regs, info->fix.smem_len / 1024, info->screen_base);
@@ -1234,8 +4122,57 @@ static int s1d13xxxfb_probe(struct platform_device *pdev)
 	if (pdata && pdata->initregs)
 		s1d13xxxfb_runinit(info->par, pdata->initregs, pdata->initregssize);
 
+
 	s1d13xxxfb_fetch_hw_state(info);
 
+	if (prod_id == S1D13506_PROD_ID && (hwcursor || ink)) {
+		s1d13xxxfb_inkcursor_init(info);
+		if (hwcursor) {
+			s1d13xxxfb_fbops.fb_cursor = s1d13xxxfb_cursor;
+			printk(KERN_INFO PFX "hardware cursor active\n");
+		}
+		if (ink)
+			printk(KERN_INFO PFX "%d KiB reserved for the ink layer\n",
+				default_par->ink_size / 1024);
+	}
+
+	default_par->offscreen_base = info->fix.smem_len;
+	if (prod_id == S1D13506_PROD_ID && offscreen > 0) {
+		s1d13xxxfb_offscreen_init(info, offscreen * 1024);
+		printk(KERN_INFO PFX "%d KiB offscreen VRAM\n",
+			(info->fix.smem_len - default_par->offscreen_base) / 1024);
+
+		/* the pattern of XOR fills and pattern blits */
+		default_par->pattern_offset = s1d13xxxfb_offscreen_alloc(info,
+				S1D_BBLT_PATTERN_SIZE, S1D_BBLT_PATTERN_SIZE);
+	}
+
+#ifdef CONFIG_FB_TILEBLITTING
+	if (prod_id == S1D13506_PROD_ID && glyph_cache) {
+		info->tileops = &s1d13xxxfb_tileops;
+		info->flags |= FBINFO_MISC_TILEBLITTING;
+	}
+#endif
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (shadow) {
+		if (s1d13xxxfb_shadow_init(info) == 0) {
+			/* ours handles the ink layer and chains to it */
+			default_par->defio_mmap = s1d13xxxfb_fbops.fb_mmap;
+			s1d13xxxfb_fbops.fb_mmap = s1d13xxxfb_mmap;
+			s1d13xxxfb_fbops.fb_write = s1d13xxxfb_shadow_write;
+			s1d13xxxfb_fbops.fb_fillrect = s1d13xxxfb_shadow_fillrect;
+			s1d13xxxfb_fbops.fb_copyarea = s1d13xxxfb_shadow_copyarea;
+			s1d13xxxfb_fbops.fb_imageblit = s1d13xxxfb_shadow_imageblit;
+		} else {
+			printk(KERN_WARNING PFX "no memory for the shadow framebuffer\n");
+		}
+	}
+#else
+	if (shadow)
+		printk(KERN_WARNING PFX "shadow framebuffer needs CONFIG_FB_DEFERRED_IO\n");
+#endif
+
 	if (register_framebuffer(info) < 0) {
 		ret = -EINVAL;
 		printk(KERN_INFO "got %d\n", ret);
@@ -1244,6 +4181,14 @@ static int s1d13xxxfb_probe(struct platform_device *pdev)
 
 	fb_info(info, "%s frame buffer device ", info->fix.id);
 
+	if (device_create_file(&pdev->dev, &dev_attr_bitblt_stats))
+		printk(KERN_WARNING PFX "unable to create bitblt_stats\n");
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (device_create_file(&pdev->dev, &dev_attr_shadow_stats))
+		printk(KERN_WARNING PFX "unable to create shadow_stats\n");
+#endif
+	s1d13xxxfb_bench_init(info);
+
 	// Enable Acceleration
 	info->flags &= ~FBINFO_HWACCEL_DISABLED;
 
@@ -1251,38 +4196,256 @@ static int s1d13xxxfb_probe(struct platform_device *pdev)
 	return 0;
 
 bail:
-	s1d13xxxfb_remove(pdev);
+	__s1d13xxxfb_remove(pdev);
 	return ret;
 
 }
 
 #ifdef CONFIG_PM
-static int s1d13xxxfb_suspend(struct platform_device *dev, pm_message_t state)
+/************************************************************
+ VRAM save and restore over suspend
+
+ Only the virtual screen, the offscreen allocations and a shown
+ ink plane are kept. The optional RLE works on 16bit words: a
+ header with S1D_RLE_RUN and the word for runs, otherwise a
+ header and that many literal words.
+ ************************************************************/
+
+#define S1D_SAVE_CHUNK		4096	/* bytes packed at a time */
+#define S1D_RLE_RUN		0x8000
+#define S1D_RLE_MAX		0x7fff
+#define S1D_RESTORE_FILL_MIN	256	/* runs the BitBLT engine fills on resume, in words */
+
+/**
+ *	s1d13xxxfb_rle_pack - run length encodes 16bit words
+ *	@dst : output, room for n + n / S1D_RLE_MAX + 1 words
+ *	@src : input
+ *	@n   : words
+ *
+ *	Runs of three or more words pay for the literal header behind
+ *	them, so the output never grows by more than the headers of
+ *	S1D_RLE_MAX sized literals. Returns the number of words written.
+ */
+static u32
+s1d13xxxfb_rle_pack(u16 *dst, const u16 *src, u32 n)
 {
-	struct fb_info *info = platform_get_drvdata(dev);
-	struct s1d13xxxfb_par *s1dfb = info->par;
-	struct s1d13xxxfb_pdata *pdata = NULL;
+	u16 *out = dst, *lit = NULL;
+	u32 i = 0, run;
+
+	while (i < n) {
+		for (run = 1; i + run < n && run < S1D_RLE_MAX &&
+				src[i + run] == src[i]; run++)
+			;
+
+		if (run >= 3) {
+			*out++ = S1D_RLE_RUN | run;
+			*out++ = src[i];
+			lit = NULL;
+			i += run;
+			continue;
+		}
 
-	/* disable display */
-	lcd_enable(s1dfb, 0);
-	crt_enable(s1dfb, 0);
+		if (!lit || *lit == S1D_RLE_MAX) {
+			lit = out++;
+			*lit = 0;
+		}
+		*out++ = src[i++];
+		(*lit)++;
+	}
 
-	if (dev_get_platdata(&dev->dev))
-		pdata = dev_get_platdata(&dev->dev);
+	return out - dst;
+}
 
-#if 0
-	if (!s1dfb->disp_save)
-		s1dfb->disp_save = kmalloc(info->fix.smem_len, GFP_KERNEL);
+static void
+s1d13xxxfb_save_add(struct s1d13xxxfb_par *par, u32 offset, u32 size)
+{
+	struct s1d13xxxfb_save_range *r;
 
-	if (!s1dfb->disp_save) {
-		printk(KERN_ERR PFX "no memory to save screen");
-		return -ENOMEM;
+	size = ALIGN(size + (offset & 1), 2);
+	offset &= ~1;
+	if (!size)
+		return;
+
+	/* the ranges come sorted, merge neighbours */
+	if (par->save_ranges) {
+		r = &par->save_range[par->save_ranges - 1];
+		if (r->offset + r->size >= offset) {
+			r->size = max(r->size, offset + size - r->offset);
+			return;
+		}
 	}
 
-	memcpy_fromio(s1dfb->disp_save, info->screen_base, info->fix.smem_len);
-#else
-	s1dfb->disp_save = NULL;
+	r = &par->save_range[par->save_ranges++];
+	r->offset = offset;
+	r->size = size;
+}
+
+/* collects the VRAM worth saving, returns its size */
+static u32
+s1d13xxxfb_save_collect(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u32 len = 0;
+	int i;
+
+	par->save_ranges = 0;
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	/* the shadow is in RAM and gets flushed again */
+	if (!par->shadow)
 #endif
+		s1d13xxxfb_save_add(par, 0, info->var.yres_virtual * info->fix.line_length);
+
+	for (i = 0; i < S1D_OFFSCREEN_MAX && par->offscreen[i].size; i++)
+		s1d13xxxfb_save_add(par, par->offscreen[i].offset, par->offscreen[i].size);
+
+	if (par->ink_on)
+		s1d13xxxfb_save_add(par, par->vram_size - par->ink_size, par->ink_size);
+
+	for (i = 0; i < par->save_ranges; i++)
+		len += par->save_range[i].size;
+	return len;
+}
+
+/**
+ *	s1d13xxxfb_save_vram - copies the used VRAM to RAM
+ *	@info : framebuffer structure
+ *
+ *	called with the engine idle and the display off
+ *
+ *	Returns negative errno on error, or zero on success.
+ */
+static int
+s1d13xxxfb_save_vram(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_save_range *r;
+	ktime_t start = ktime_get();
+	u8 *buf, *packed, *chunk = NULL;
+	u32 len, max, out = 0, off, n;
+	int i;
+
+	len = s1d13xxxfb_save_collect(info);
+	if (!len)
+		return 0;
+
+	par->save_rle = (vram_save == 2);
+	max = len;
+	if (par->save_rle) {
+		max += 2 * (len / S1D_SAVE_CHUNK + S1D_SAVE_RANGES);
+		chunk = kmalloc(S1D_SAVE_CHUNK, GFP_KERNEL);
+		if (!chunk)
+			return -ENOMEM;
+	}
+
+	buf = vmalloc(max);
+	if (!buf) {
+		kfree(chunk);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < par->save_ranges; i++) {
+		r = &par->save_range[i];
+		if (!par->save_rle) {
+			s1d13xxxfb_burst_fromio(buf + out, par->vram + r->offset, r->size);
+			out += r->size;
+			continue;
+		}
+
+		for (off = 0; off < r->size; off += n) {
+			n = min_t(u32, r->size - off, S1D_SAVE_CHUNK);
+			s1d13xxxfb_burst_fromio(chunk, par->vram + r->offset + off, n);
+			out += 2 * s1d13xxxfb_rle_pack((u16 *)(buf + out),
+					(const u16 *)chunk, n >> 1);
+		}
+	}
+	kfree(chunk);
+
+	/* don't keep the worst case allocated over suspend */
+	if (out < max) {
+		packed = vmalloc(out);
+		if (packed) {
+			memcpy(packed, buf, out);
+			vfree(buf);
+			buf = packed;
+		}
+	}
+
+	par->disp_save = buf;
+	printk(KERN_INFO PFX "saved %u KiB of VRAM in %u KiB, %lld us\n",
+		len >> 10, out >> 10, ktime_us_delta(ktime_get(), start));
+	return 0;
+}
+
+/* a run of one word, long ones are left to the engine */
+static void
+s1d13xxxfb_restore_run(struct fb_info *info, u32 offset, u32 words, u16 val)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	u8 __iomem *dst = par->vram + offset;
+	u32 val32 = val | (val << 16);
+
+	if (words >= S1D_RESTORE_FILL_MIN && par->prod_id == S1D13506_PROD_ID &&
+	    !(info->flags & FBINFO_HWACCEL_DISABLED)) {
+		bltbit_fill_linear(info, offset, words << 1, val);
+		return;
+	}
+
+	if (((unsigned long)dst & 2) && words) {
+		__raw_writew(val, dst);
+		dst += 2;
+		words--;
+	}
+	for (; words >= 2; dst += 4, words -= 2)
+		__raw_writel(val32, dst);
+	if (words)
+		__raw_writew(val, dst);
+}
+
+/* writes disp_save back, before the display is switched on */
+static void
+s1d13xxxfb_restore_vram(struct fb_info *info)
+{
+	struct s1d13xxxfb_par *par = info->par;
+	struct s1d13xxxfb_save_range *r;
+	ktime_t start = ktime_get();
+	const u16 *in = par->disp_save;
+	u32 off, end, n;
+	u16 hdr;
+	int i;
+
+	for (i = 0; i < par->save_ranges; i++) {
+		r = &par->save_range[i];
+		if (!par->save_rle) {
+			s1d13xxxfb_burst_toio(par->vram + r->offset, (const u8 *)in, r->size);
+			in += r->size >> 1;
+			continue;
+		}
+
+		for (off = r->offset, end = off + r->size; off < end; off += n << 1) {
+			hdr = *in++;
+			n = hdr & S1D_RLE_MAX;
+			if (hdr & S1D_RLE_RUN) {
+				s1d13xxxfb_restore_run(info, off, n, *in++);
+			} else {
+				s1d13xxxfb_burst_toio(par->vram + off, (const u8 *)in, n << 1);
+				in += n;
+			}
+		}
+	}
+
+	/* the engine may still be filling the last runs */
+	s1d13xxxfb_sync(info);
+
+	printk(KERN_INFO PFX "restored VRAM in %lld us\n",
+		ktime_us_delta(ktime_get(), start));
+}
+
+static int s1d13xxxfb_suspend(struct platform_device *dev, pm_message_t state)
+{
+	struct fb_info *info = platform_get_drvdata(dev);
+	struct s1d13xxxfb_par *s1dfb = info->par;
+	struct s1d13xxxfb_pdata *pdata = NULL;
 
 	if (!s1dfb->regs_save)
 		s1dfb->regs_save = kmalloc(info->fix.mmio_len, GFP_KERNEL);
@@ -1292,6 +4455,22 @@ static int s1d13xxxfb_suspend(struct platform_device *dev, pm_message_t state)
 		return -ENOMEM;
 	}
 
+	/* let the engine finish before the chip goes to sleep */
+	s1d13xxxfb_sync(info);
+
+	/* disable display */
+	lcd_enable(s1dfb, 0);
+	crt_enable(s1dfb, 0);
+
+	if (dev_get_platdata(&dev->dev))
+		pdata = dev_get_platdata(&dev->dev);
+
+	/* without the copy the clients repaint after resume */
+	vfree(s1dfb->disp_save);
+	s1dfb->disp_save = NULL;
+	if (vram_save && s1d13xxxfb_save_vram(info))
+		printk(KERN_WARNING PFX "no memory to save VRAM\n");
+
 	/* backup all registers */
 	memcpy_fromio(s1dfb->regs_save, s1dfb->regs, info->fix.mmio_len);
 
@@ -1324,12 +4503,26 @@ static int s1d13xxxfb_resume(struct platform_device *dev)
 		/* will write RO regs, *should* get away with it :) */
 		memcpy_toio(s1dfb->regs, s1dfb->regs_save, info->fix.mmio_len);
 		kfree(s1dfb->regs_save);
+		s1dfb->regs_save = NULL;
 	}
+	bltbit_invalidate(s1dfb);
+	/* the cursor page is never saved, upload the shape again */
+	s1dfb->cursor_valid = 0;
+#ifdef CONFIG_FB_DEFERRED_IO
+	s1d13xxxfb_shadow_invalidate(info);
+#endif
 
 	if (s1dfb->disp_save) {
-		memcpy_toio(info->screen_base, s1dfb->disp_save,
-				info->fix.smem_len);
-		kfree(s1dfb->disp_save);	/* XXX kmalloc()'d when? */
+		/* with the offscreen areas back the pattern and glyphs are still good */
+		s1d13xxxfb_restore_vram(info);
+		vfree(s1dfb->disp_save);
+		s1dfb->disp_save = NULL;
+	} else {
+		/* VRAM didn't survive, upload the pattern and glyphs again */
+		s1dfb->pattern_solid = 0;
+#ifdef CONFIG_FB_TILEBLITTING
+		memset(s1dfb->glyph_tag, 0, sizeof(s1dfb->glyph_tag));
+#endif
 	}
 
 	if ((s1dfb->display & 0x01) != 0)
@@ -0,0 +1,122 @@
+/* include/uapi/video/s1d13xxxfb.h
+ *
+ * Userspace interface of the Epson S1D13XXX driver
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#ifndef	_UAPI_S1D13XXXFB_H
+#define	_UAPI_S1D13XXXFB_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Ink layer: a 2bpp overlay over the whole LCD, drawn by the Ink/Cursor
+ * unit on top of the framebuffer. Map it with mmap() at
+ * S1DFB_INK_MMAP_OFFSET, leftmost pixel in the high bits of a byte on
+ * big endian framebuffers and in the low bits otherwise.
+ */
+#define S1DFB_INK_COLOR0		0	/* ink pixel values */
+#define S1DFB_INK_COLOR1		1
+#define S1DFB_INK_TRANSPARENT		2
+#define S1DFB_INK_INVERT		3
+
+#define S1DFB_INK_MMAP_OFFSET		0x40000000
+
+struct s1dfb_ink {
+	__u32	enable;		/* ink layer shown instead of the cursor */
+	__u32	color0;		/* RGB565 */
+	__u32	color1;
+	__u32	width;		/* read only: pixels */
+	__u32	height;
+	__u32	pitch;		/* read only: bytes per line */
+	__u32	size;		/* read only: mappable bytes */
+};
+
+#define S1DFB_IOC_INK_GET		_IOR('F', 0x80, struct s1dfb_ink)
+#define S1DFB_IOC_INK_SET		_IOW('F', 0x81, struct s1dfb_ink)
+#define S1DFB_IOC_INK_CLEAR		_IOW('F', 0x82, __u32)	/* ink pixel value */
+
+/*
+ * BitBLT batches: S1DFB_IOC_BLIT runs an array of operations with one
+ * call. Coordinates are pixels of the virtual screen, colors are pixel
+ * values in the framebuffer format. Write blits take the data in screen
+ * depth, in 4bpp their x and width have to be even. The call returns
+ * when the last operation is started unless S1DFB_BLT_BATCH_SYNC is set.
+ */
+#define S1DFB_BLT_FILL			0
+#define S1DFB_BLT_COPY			1	/* sx, sy to dx, dy, may overlap */
+#define S1DFB_BLT_WRITE			2	/* data to dx, dy */
+#define S1DFB_BLT_EXPAND		3	/* 1bpp data, MSB first, fg and bg */
+#define S1DFB_BLT_PATTERN		4	/* 8x8 pattern in data, see below */
+
+/*
+ * Raster operations of FILL (fg is the source), COPY, WRITE and PATTERN,
+ * S is the source and D the destination. 0 means S1DFB_ROP_COPY. Only
+ * S1DFB_ROP_COPY fills that span whole lines of the virtual screen can
+ * be taller than 1024 lines, they are done in the linear mode.
+ */
+#define S1DFB_ROP(code)			(0x10 | (code))
+#define S1DFB_ROP_CLEAR			S1DFB_ROP(0x0)	/* 0 */
+#define S1DFB_ROP_NOR			S1DFB_ROP(0x1)	/* ~(S | D) */
+#define S1DFB_ROP_AND_INVERTED		S1DFB_ROP(0x2)	/* ~S & D */
+#define S1DFB_ROP_COPY_INVERTED		S1DFB_ROP(0x3)	/* ~S */
+#define S1DFB_ROP_AND_REVERSE		S1DFB_ROP(0x4)	/* S & ~D */
+#define S1DFB_ROP_INVERT		S1DFB_ROP(0x5)	/* ~D */
+#define S1DFB_ROP_XOR			S1DFB_ROP(0x6)	/* S ^ D */
+#define S1DFB_ROP_NAND			S1DFB_ROP(0x7)	/* ~(S & D) */
+#define S1DFB_ROP_AND			S1DFB_ROP(0x8)	/* S & D */
+#define S1DFB_ROP_EQUIV			S1DFB_ROP(0x9)	/* ~(S ^ D) */
+#define S1DFB_ROP_NOOP			S1DFB_ROP(0xa)	/* D */
+#define S1DFB_ROP_OR_INVERTED		S1DFB_ROP(0xb)	/* ~S | D */
+#define S1DFB_ROP_COPY			S1DFB_ROP(0xc)	/* S */
+#define S1DFB_ROP_OR_REVERSE		S1DFB_ROP(0xd)	/* S | ~D */
+#define S1DFB_ROP_OR			S1DFB_ROP(0xe)	/* S | D */
+#define S1DFB_ROP_SET			S1DFB_ROP(0xf)	/* 1 */
+
+/*
+ * S1DFB_BLT_TRANSPARENT: COPY, WRITE and PATTERN skip source pixels equal
+ * to bg (color key), EXPAND skips the clear bits. Only with S1DFB_ROP_COPY,
+ * and COPY only when the destination doesn't overlap the source from
+ * below or the right (the engine can't do it backwards).
+ *
+ * PATTERN fills the rectangle with an 8x8 pattern in screen depth, 16x8
+ * pixels in 4bpp, lines packed. It is anchored to the screen: pixel x, y
+ * gets pattern pixel x & 7, y & 7. Needs offscreen VRAM (the "offscreen"
+ * module parameter), so do other ROPs than COPY for FILL.
+ */
+#define S1DFB_BLT_TRANSPARENT		0x01
+
+#define S1DFB_BLT_MAX_OPS		256
+#define S1DFB_BLT_BATCH_SYNC		0x01	/* wait for the engine before returning */
+
+struct s1dfb_blt_op {
+	__u32	op;
+	__u32	rop;		/* S1DFB_ROP_xxx */
+	__u32	dx;
+	__u32	dy;
+	__u32	width;
+	__u32	height;
+	__u32	sx;
+	__u32	sy;
+	__u32	fg;
+	__u32	bg;
+	__u32	pitch;		/* bytes from one data line to the next */
+	__u32	flags;		/* S1DFB_BLT_TRANSPARENT */
+	__u64	data;		/* user pointer */
+};
+
+struct s1dfb_blt_batch {
+	__u64	ops;		/* user pointer to count operations */
+	__u32	count;
+	__u32	flags;
+	__u32	done;		/* out: operations carried out */
+	__u32	reserved;
+};
+
+#define S1DFB_IOC_BLIT			_IOWR('F', 0x83, struct s1dfb_blt_batch)
+
+#endif /* _UAPI_S1D13XXXFB_H */
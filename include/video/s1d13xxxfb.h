@@ -13,6 +13,8 @@
 #ifndef	S1D13XXXFB_H
 #define	S1D13XXXFB_H
 
+#include <uapi/video/s1d13xxxfb.h>
+
 #define S1D_PALETTE_SIZE		256
 #define S1D_FBID			"S1D13xxx"
 #define S1D_DEVICENAME			"s1d13xxxfb"
@@ -136,8 +138,34 @@
 #define S1DREG_DELAYOFF			0xFFFE
 #define S1DREG_DELAYON			0xFFFF
 
+/* BitBLT operations (S1DREG_BBLT_OP) */
+#define BBLT_WRITE			0x00
+#define BBLT_MOVE_POS			0x02
+#define BBLT_MOVE_NEG			0x03
+#define BBLT_WRITE_TRANSP		0x04	/* skips pixels equal to the background color */
+#define BBLT_MOVE_TRANSP		0x05	/* positive direction only */
+#define BBLT_PATTERN			0x06	/* 8x8 pattern as source */
+#define BBLT_PATTERN_TRANSP		0x07
+#define BBLT_COLOR_EXP			0x08
+#define BBLT_COLOR_EXP_TRANSP		0x09	/* clear bits are skipped */
 #define BBLT_SOLID_FILL			0x0c
 
+/* BitBLT raster operations (S1DREG_BBLT_CC_EXP), S = source or pattern, D = destination */
+#define BBLT_ROP_ZERO			0x00
+#define BBLT_ROP_XOR			0x06	/* S ^ D */
+#define BBLT_ROP_COPY			0x0c	/* S */
+#define BBLT_ROP_ONE			0x0f
+
+/* BitBLT control bits (S1DREG_BBLT_CTL0, write) */
+#define BBLT_DST_LINEAR			0x02
+#define BBLT_SRC_LINEAR			0x01
+
+/* BitBLT status bits (S1DREG_BBLT_CTL0, read) */
+#define BBLT_ACTIVE			0x80
+#define BBLT_FIFO_NOT_EMPTY		0x40
+#define BBLT_FIFO_HALF_FULL		0x20
+#define BBLT_FIFO_FULL			0x10
+
 #define S1DREG_BBLT_DATA0               0x100000 /* Bit blit data */
 
 /* Note: all above defines should go in separate header files
@@ -148,16 +176,148 @@ struct s1d13xxxfb_regval {
 	u8	value;
 };
 
+/* BitBLT registers S1DREG_BBLT_CTL0 .. S1DREG_BBLT_FGC1 are shadowed */
+#define S1D_BBLT_SHADOW_SIZE		0x1a
+
+/* S1DREG_LCD_NDISP_VPER / S1DREG_CRT_NDISP_VPER: in the vertical non-display period */
+#define S1D_VNDP_STATUS			0x80
+
+/* Ink/Cursor unit */
+#define S1D_CUR_CTL_OFF			0x00	/* S1DREG_xxx_CUR_CTL mode bits */
+#define S1D_CUR_CTL_CURSOR		0x01
+#define S1D_CUR_CTL_INK			0x02
+#define S1D_CURSOR_WIDTH		64
+#define S1D_CURSOR_HEIGHT		64
+#define S1D_CURSOR_SIZE			(S1D_CURSOR_WIDTH * S1D_CURSOR_HEIGHT / 4)	/* 2bpp */
+
+/* offscreen VRAM allocations, glyph cache slots */
+#define S1D_OFFSCREEN_MAX		8
+#define S1D_GLYPH_MAX			512
+
+/* 8x8 pattern of the pattern fill blits, 16bpp size and alignment */
+#define S1D_BBLT_PATTERN_SIZE		128
+
+/* longest line the CPU packs for a 4bpp blit, in bytes */
+#define S1D_BBLT_LINE_MAX		512
+
+/* bitblt operations for the statistics */
+enum s1d13xxxfb_blt_op {
+	S1D_BLT_COPY,
+	S1D_BLT_FILL,
+	S1D_BLT_EXPAND,
+	S1D_BLT_WRITE,
+	S1D_BLT_PATTERN,
+	S1D_BLT_NR_OPS,
+};
+
+struct s1d13xxxfb_blt_stats {
+	unsigned long	calls;
+	unsigned long	writes;		/* register bus cycles */
+	unsigned long	saved;		/* byte writes skipped or merged */
+};
+
+struct s1d13xxxfb_shadow_stats {
+	unsigned long	frames;		/* flushes that wrote something */
+	unsigned long	last_dirty;	/* bytes in dirty lines, last flush */
+	unsigned long	last_written;	/* bytes written to VRAM, last flush */
+	unsigned long	last_us;	/* duration of the last flush */
+	u64		dirty;		/* totals */
+	u64		written;
+};
+
+struct s1d13xxxfb_offscreen {
+	u32	offset;		/* bytes from the start of VRAM */
+	u32	size;		/* 0 = unused entry */
+};
+
+/* VRAM saved over suspend: virtual screen, offscreen areas, ink plane */
+#define S1D_SAVE_RANGES			(S1D_OFFSCREEN_MAX + 2)
+
+struct s1d13xxxfb_save_range {
+	u32	offset;
+	u32	size;		/* bytes, even */
+};
+
 struct s1d13xxxfb_par {
 	void __iomem	*regs;
+	void __iomem	*vram;		/* screen_base points to the shadow if used */
+	u32		vram_size;	/* smem_len is lower if the top is reserved */
 	unsigned char	display;
 	unsigned char	prod_id;
 	unsigned char	revision;
 
 	unsigned int	pseudo_palette[16];
+	int		blt_busy;	/* blit kicked off, not waited for yet */
+
+	u8		blt_shadow[S1D_BBLT_SHADOW_SIZE];	/* what the engine registers hold */
+	u32		blt_valid;	/* one bit per valid shadow byte */
+	int		blt_op;		/* S1D_BLT_xxx being programmed */
+	struct s1d13xxxfb_blt_stats blt_stats[S1D_BLT_NR_OPS];
+	u32		blt_line[S1D_BBLT_LINE_MAX / 4];	/* 4bpp packing, under the bitblt lock */
+	u8		*blt_bounce;	/* user data of S1DFB_IOC_BLIT, under info->lock */
+	u32		pattern_offset;	/* 8x8 pattern in offscreen VRAM, 0 = none */
+	u32		pattern_color;	/* solid color the pattern holds */
+	int		pattern_solid;	/* pattern_color is valid */
+
+	/* hardware cursor, image in the last S1D_CURSOR_SIZE bytes of VRAM */
+	int		cursor_on;
+	int		cursor_valid;	/* VRAM holds cursor_image */
+	u16		cursor_pending;	/* FB_CUR_SET* seen while disabled */
+	u8		cursor_image[S1D_CURSOR_SIZE];
+	u8		cursor_build[S1D_CURSOR_SIZE];
+
+	/* ink layer, the top ink_size bytes of VRAM, includes the cursor image */
+	u32		ink_size;
+	int		ink_on;
+	u16		ink_color[2];
+
+	/* offscreen VRAM from offscreen_base to smem_len, sorted by offset */
+	u32		offscreen_base;
+	struct s1d13xxxfb_offscreen offscreen[S1D_OFFSCREEN_MAX];
+
+#ifdef CONFIG_FB_TILEBLITTING
+	/* console font for the tile ops, glyphs cached in offscreen VRAM */
+	const u8	*tile_data;
+	u32		tile_width;
+	u32		tile_height;
+	u32		tile_count;
+	u32		tile_bytes;	/* per glyph in tile_data */
+	u32		glyph_offset;	/* 0 = no cache */
+	u32		glyph_slots;
+	u32		glyph_cols;
+	u32		glyph_tag[S1D_GLYPH_MAX];	/* index and colors held by a slot */
+	u8		tile_cursor_mask[S1D_CURSOR_WIDTH / 8 * S1D_CURSOR_HEIGHT];
+	int		tile_cursor_on;	/* software cursor XORed at tile_cursor_x/y */
+	u32		tile_cursor_x;
+	u32		tile_cursor_y;
+	u32		tile_cursor_h;
+	u32		tile_cursor_color;
+#endif
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	/* shadow framebuffer in RAM, flushed to VRAM by deferred io */
+	u8		*shadow;
+	u8		*shadow_copy;	/* what VRAM holds, for the tile compare */
+	unsigned long	*shadow_dirty;	/* one bit per line */
+	unsigned long	*shadow_flush;
+	unsigned int	shadow_bits;
+	int		shadow_force;	/* VRAM contents lost, write all dirty tiles */
+	spinlock_t	shadow_lock;
+	struct fb_deferred_io shadow_defio;
+	int		(*defio_mmap)(struct fb_info *info, struct vm_area_struct *vma);	/* set up by fb_deferred_io */
+	struct s1d13xxxfb_shadow_stats shadow_stats;
+#endif
 #ifdef CONFIG_PM
 	void		*regs_save;	/* pm saves all registers here */
-	void		*disp_save;	/* pm saves entire screen here */
+	void		*disp_save;	/* pm saves the used VRAM here, vmalloc'd */
+	struct s1d13xxxfb_save_range save_range[S1D_SAVE_RANGES];
+	int		save_ranges;
+	int		save_rle;	/* disp_save is run length encoded */
+#endif
+#ifdef CONFIG_DEBUG_FS
+	struct dentry	*debugfs;
+	char		*bench_buf;	/* table of the last benchmark run */
+	size_t		bench_len;
 #endif
 };
 
@@ -0,0 +1,182 @@
+/*
+ *  jornada720-ratecal.c
+ *
+ *  Probe-time calibration of the maximum usable samplerate.
+ *
+ *  The SAC DMA engine is only refilled from the DMA done interrupt, so the
+ *  Tx FIFO has to bridge our interrupt latency. How much latency we can
+ *  afford depends on the samplerate (16 FIFO entries last 333us at 48kHz,
+ *  2ms at 8kHz) and on what else is going on with interrupts off. Instead of
+ *  guessing rate_limit, we play a silent stream at each candidate rate while
+ *  a hrtimer burns a configurable amount of hard-IRQ time, and look at the
+ *  FIFO level and underrun flag every time a period is refilled.
+ *
+ *  Copyright (C) 2021 Timo Biesenbach
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+#include <linux/init.h>
+#include <linux/err.h>
+#include <linux/platform_device.h>
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+#include <linux/time.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/types.h>
+// Hardware stuff
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/dma-mapping.h>
+#include <asm/irq.h>
+#include <asm/dma.h>
+#include <mach/jornada720.h>
+#include <mach/hardware.h>
+#include <asm/hardware/sa1111.h>
+
+#include "jornada720-common.h"
+#include "jornada720-sac.h"
+#include "jornada720-sacdma.h"
+#include "jornada720-uda1344.h"
+#include "jornada720-ratecal.h"
+
+// ********* Debugging tools **********
+#undef DEBUG
+
+#ifdef DEBUG
+#define DPRINTK(format,args...) printk(KERN_DEBUG format,##args)
+#else
+#define DPRINTK(format,args...)
+#endif
+// ********* Debugging tools **********
+
+static const int ratecal_rates[RATECAL_NUM_RATES] = {
+	48000, 44100, 32000, 22050, 16000, 11025, 8000,
+};
+
+// The DMA interrupt handler keeps a pointer to the buffer, so it can't live on the stack
+static dma_buf_t ratecal_buffer;
+
+// Synthetic IRQ load generator
+static struct hrtimer ratecal_load_timer;
+static int ratecal_load_us;
+
+/* Burn ratecal_load_us of hard-IRQ time every RATECAL_LOAD_PERIOD_US */
+static enum hrtimer_restart ratecal_load_fn(struct hrtimer *timer) {
+	udelay(ratecal_load_us);
+	hrtimer_forward_now(timer, ns_to_ktime((u64)RATECAL_LOAD_PERIOD_US * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+static void ratecal_load_start(int load_us) {
+	if (load_us <= 0) return;
+
+	// keep at least half of the CPU for everyone else
+	if (load_us > RATECAL_LOAD_PERIOD_US/2) load_us = RATECAL_LOAD_PERIOD_US/2;
+	ratecal_load_us = load_us;
+
+	hrtimer_init(&ratecal_load_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ratecal_load_timer.function = ratecal_load_fn;
+	hrtimer_start(&ratecal_load_timer, ns_to_ktime((u64)RATECAL_LOAD_PERIOD_US * NSEC_PER_USEC), HRTIMER_MODE_REL);
+}
+
+static void ratecal_load_stop(void) {
+	if (ratecal_load_us <= 0) return;
+	hrtimer_cancel(&ratecal_load_timer);
+	ratecal_load_us = 0;
+}
+
+/* Play the silent buffer for RATECAL_WINDOW_MS at rate and fill in res */
+static int ratecal_test_rate(struct sa1111_dev *devptr, int rate, int max_underruns, struct jornada720_ratecal_result *res) {
+	s64 period_ns, late;
+	int err;
+
+	memset(res, 0, sizeof(*res));
+	res->rate = rate;
+
+	uda1344_set_samplerate(devptr, rate);
+	sa1111_audio_setsamplerate(devptr, rate);
+
+	ratecal_buffer.dma_ptr = ratecal_buffer.dma_start;
+	sa1111_dma_reset_stats(&ratecal_buffer);
+
+	// Clear a stale underrun flag from before
+	sa1111_sac_writereg(devptr, SASCR_TUR, SA1111_SASCR);
+
+	err = sa1111_dma_playback(devptr, &ratecal_buffer, NULL);
+	if (err < 0) {
+		printk(KERN_ERR "ratecal: sa1111_dma_playback() failed at %d Hz.\n", rate);
+		return err;
+	}
+	msleep(RATECAL_WINDOW_MS);
+	sa1111_dma_playstop(devptr, &ratecal_buffer);
+
+	// One FIFO entry holds one 16bit stereo frame
+	period_ns = div_s64((s64)(RATECAL_PERIOD_SIZE / 4) * NSEC_PER_SEC, rate);
+	late = ratecal_buffer.irq_gap_max - period_ns;
+	if (late < 0) late = 0;
+
+	res->periods     = ratecal_buffer.periods;
+	res->underruns   = ratecal_buffer.underruns;
+	res->fifo_min    = ratecal_buffer.fifo_min;
+	res->margin_us   = (ratecal_buffer.fifo_min * 1000000) / rate;
+	res->late_max_us = (int)div_s64(late, NSEC_PER_USEC);
+	res->passed      = (res->periods > 0) && (res->underruns <= max_underruns);
+
+	DPRINTK(KERN_INFO "ratecal: %d Hz: periods %u underruns %u fifo_min %u margin %dus late %dus\n",
+		rate, res->periods, res->underruns, res->fifo_min, res->margin_us, res->late_max_us);
+	return 0;
+}
+
+/// ********** PUBLIC INTERFACE *************************
+
+/* Run the calibration over all candidate rates. Returns the highest rate that passed. */
+int jornada720_ratecal_run(struct sa1111_dev *devptr, struct jornada720_ratecal *cal) {
+	size_t size = RATECAL_PERIOD_SIZE * RATECAL_PERIODS;
+	dma_addr_t handle;
+	void *area;
+	int i, err = 0;
+	int best = 0;
+
+	area = dma_alloc_coherent(&devptr->dev, size, &handle, GFP_KERNEL);
+	if (!area) {
+		printk(KERN_ERR "ratecal: unable to allocate DMA buffer.\n");
+		return -ENOMEM;
+	}
+	memset(area, 0, size);   // silence
+
+	memset(&ratecal_buffer, 0, sizeof(ratecal_buffer));
+	ratecal_buffer.dma_start   = handle;
+	ratecal_buffer.dma_ptr     = handle;
+	ratecal_buffer.virt_addr   = area;
+	ratecal_buffer.size        = size;
+	ratecal_buffer.period_size = RATECAL_PERIOD_SIZE;
+	ratecal_buffer.loop        = 1;
+
+	ratecal_load_start(cal->load_us);
+
+	// Test all rates so that the margins can be reported, remember the best one that passed
+	for (i = 0; i < RATECAL_NUM_RATES; i++) {
+		err = ratecal_test_rate(devptr, ratecal_rates[i], cal->max_underruns, &cal->results[i]);
+		if (err < 0) break;
+		if (cal->results[i].passed && !best) best = ratecal_rates[i];
+	}
+
+	ratecal_load_stop();
+	dma_free_coherent(&devptr->dev, size, area, handle);
+
+	if (err < 0) return err;
+
+	// Nothing passed, fall back to the lowest rate we have
+	if (!best) best = ratecal_rates[RATECAL_NUM_RATES-1];
+
+	cal->rate = best;
+	cal->runs++;
+	return best;
+}
@@ -0,0 +1,56 @@
+/*
+ *  jornada720-ratecal.h
+ *
+ *  Probe-time calibration of the maximum usable samplerate
+ *
+ *  Copyright (C) 2021 Timo Biesenbach
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+#ifndef JORNADA720_RATECAL_H
+#define JORNADA720_RATECAL_H
+
+#include <asm/hardware/sa1111.h>
+
+// Candidate samplerates, highest first
+#define RATECAL_NUM_RATES	(7)
+
+// Length of the silent test stream per candidate rate
+#define RATECAL_WINDOW_MS	(250)
+
+// Period setup of the test stream, two periods of one page each
+#define RATECAL_PERIOD_SIZE	(4096)
+#define RATECAL_PERIODS		(2)
+
+// Synthetic IRQ load: busy loop of load_us microseconds every RATECAL_LOAD_PERIOD_US
+#define RATECAL_LOAD_PERIOD_US	(1000)
+
+/* Result of the test run at one samplerate */
+struct jornada720_ratecal_result {
+	int				rate;			/* samplerate tested */
+	unsigned int	periods;		/* # of periods played in the window */
+	unsigned int	underruns;		/* # of Tx FIFO underruns seen */
+	unsigned int	fifo_min;		/* lowest Tx FIFO level at refill time */
+	int				margin_us;		/* fifo_min converted to time at this rate */
+	int				late_max_us;	/* worst DMA done interrupt lateness against the period time */
+	int				passed;			/* 1 if the rate stayed below the underrun threshold */
+};
+
+/* Calibration setup and results */
+struct jornada720_ratecal {
+	int		load_us;				/* synthetic IRQ load, usec per RATECAL_LOAD_PERIOD_US */
+	int		max_underruns;			/* underrun threshold per window */
+	int		rate;					/* resulting maximum samplerate, 0 if never run */
+	int		runs;					/* # of calibration runs */
+	struct jornada720_ratecal_result results[RATECAL_NUM_RATES];
+};
+
+/* Play a silent stream at each candidate rate and record the refill margins in cal.
+ * Returns the highest rate that passed, or a negative error code. The caller must make
+ * sure that the playback DMA channel is idle. */
+extern int jornada720_ratecal_run(struct sa1111_dev *devptr, struct jornada720_ratecal *cal);
+
+// From top ifndef
+#endif
@@ -20,6 +20,10 @@
 #define AUDXMTDMADONEB		(34)
 #define AUDRCVDMADONEB		(35)
 
+/* SAC transmit FIFO: 16 entries, fill level in SASR0 bits 8-11 (see section 7.4 in datasheet) */
+#define SAC_FIFO_DEPTH			(16)
+#define SAC_TX_FIFO_LEVEL(sasr0)	(((sasr0) >> 8) & 0x0f)
+
 /*	Get the parent device driver structure from a child function device
  *  Copied here from sa1111.c since unfortunately not exported by sa1111.h  */
 struct sa1111 {
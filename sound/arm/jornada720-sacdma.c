@@ -246,6 +246,33 @@ static int start_sa1111_sac_dma(struct sa1111_dev *devptr, dma_addr_t dma_ptr, s
 	return 0;
 }
 
+/* Track the refill margin of the transmit channel. Called from the DMA done interrupt
+ * right before the next block is started: the Tx FIFO level at this point is what is
+ * left to bridge our interrupt latency, the underrun flag tells if that wasn't enough.
+ */
+static void track_sa1111_sac_refill(struct sa1111_dev *devptr, dma_buf_t *buf) {
+	unsigned int val;
+	ktime_t now = ktime_get();
+	s64 gap;
+
+	val = sa1111_sac_readreg(devptr, SA1111_SASR0);
+	if (SAC_TX_FIFO_LEVEL(val) < buf->fifo_min)
+		buf->fifo_min = SAC_TX_FIFO_LEVEL(val);
+
+	// Count and clear the underrun flag
+	if (val & SASR0_TUR) {
+		buf->underruns++;
+		sa1111_sac_writereg(devptr, SASCR_TUR, SA1111_SASCR);
+	}
+
+	if (ktime_to_ns(buf->irq_last) != 0) {
+		gap = ktime_to_ns(ktime_sub(now, buf->irq_last));
+		if (gap > buf->irq_gap_max) buf->irq_gap_max = gap;
+	}
+	buf->irq_last = now;
+	buf->periods++;
+}
+
 static int stop_sa1111_sac_dma(struct sa1111_dev *devptr, int direction) {
 	// we can't stop the hardware, so just set running to 0
 	dma_channels[direction].running=0;
@@ -280,6 +307,9 @@ static irqreturn_t sa1111_dma_irqhandler(int irq, void *devptr)  {
 			// Advance ptr by the period size played
 			dma_channels[SA1111_SAC_XMT_CHANNEL].dma_buffer->dma_ptr += dma_channels[SA1111_SAC_XMT_CHANNEL].dma_buffer->period_size;
 
+			// Sample FIFO level / underrun flag before we refill
+			track_sa1111_sac_refill(devptr, dma_channels[SA1111_SAC_XMT_CHANNEL].dma_buffer);
+
 			// Don't restart DMA if not running
 			if (dma_channels[SA1111_SAC_XMT_CHANNEL].running) {
 
@@ -462,6 +492,15 @@ int sa1111_dma_release(struct sa1111_dev *devptr) {
 	return 0;
 }
 
+/* Reset the refill statistics of a buffer, e.g. before starting playback */
+void sa1111_dma_reset_stats(dma_buf_t *dma_buffer) {
+	dma_buffer->periods = 0;
+	dma_buffer->underruns = 0;
+	dma_buffer->fifo_min = SAC_FIFO_DEPTH;
+	dma_buffer->irq_last = ktime_set(0, 0);
+	dma_buffer->irq_gap_max = 0;
+}
+
 int sa1111_dma_playback(struct sa1111_dev *devptr, dma_buf_t *dma_buffer, dma_block_callback callback) {
 	DPRINTK(KERN_INFO "sacdma: sa1111_dma_playback\n");
 	struct sa1111 *sachip = get_sa1111_base_drv(devptr);
@@ -522,6 +561,7 @@ int sa1111_dma_playstop(struct sa1111_dev *devptr, dma_buf_t *dma_buffer) {
 	int timeout=0;
 	while (!is_done_sa1111_sac_dma(devptr, SA1111_SAC_XMT_CHANNEL) && timeout<1000) {
 		udelay(10);
+		timeout++;
 	}
 
 	spin_unlock_irqrestore(&sachip->lock, flags);
@@ -40,6 +40,12 @@ typedef struct dma_buf_s {
 	struct snd_jornada720* snd_jornada720; 	/* jornada720 sounddevice for use in callback */
 	bool		loop;						/* Play continously? */
 	int			loop_count;					/* # of loops played */
+	/* refill statistics, updated from the DMA done interrupt */
+	unsigned int	periods;				/* # of periods played */
+	unsigned int	underruns;				/* # of Tx FIFO underruns seen at refill time */
+	unsigned int	fifo_min;				/* lowest Tx FIFO level seen at refill time */
+	ktime_t		irq_last;					/* time of the last DMA done interrupt */
+	s64			irq_gap_max;				/* longest time between two DMA done interrupts, ns */
 } dma_buf_t;
 
 /* function to call when DMA_BLOCK_SIZE portion of dma_buffer is transferred */
@@ -57,6 +63,9 @@ extern  int sa1111_dma_playback(struct sa1111_dev *devptr, dma_buf_t *dma_buffer
 /* Stop playback on the sa1111 device*/
 extern  int sa1111_dma_playstop(struct sa1111_dev *devptr, dma_buf_t *dma_buffer);
 
+/* Reset the refill statistics of dma_buffer */
+extern  void sa1111_dma_reset_stats(dma_buf_t *dma_buffer);
+
 /* Record sound into the data buffer from dma_ptr with size bytes on the sa1111 device and call the callback function each DMA_BLOCK_SIZE bytes */
 // extern  int sa1111_dma_record(struct sa1111_dev *devptr, dma_buf_t *dma_buffer, dma_block_callback callback);
 
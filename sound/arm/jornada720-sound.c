@@ -45,6 +45,7 @@
 #include <linux/module.h>
 #include <linux/delay.h>
 #include <linux/types.h>
+#include <linux/mutex.h>
 // Hardware stuff
 #include <linux/kernel.h>
 #include <linux/ioport.h>
@@ -70,6 +71,7 @@
 
 // Sounddriver components
 #include "jornada720-common.h"
+#include "jornada720-ratecal.h"
 #include "jornada720-sound.h"
 #include "jornada720-sac.h"
 #include "jornada720-sacdma.h"
@@ -108,11 +110,42 @@ static int rate_limit = 48000;
 module_param(rate_limit, int, 0444);
 MODULE_PARM_DESC(rate_limit, "Driver will only offer samplerates equal or below this limit if specified.");
 
+static int rate_calibrate = 0;
+module_param(rate_calibrate, int, 0444);
+MODULE_PARM_DESC(rate_calibrate, "1: measure the highest samplerate that plays without underruns at probe time and lower rate_limit to it.");
+
+static int rate_calibrate_load = 200;
+module_param(rate_calibrate_load, int, 0444);
+MODULE_PARM_DESC(rate_calibrate_load, "Synthetic IRQ load during calibration in usec per msec (default 200, max 500).");
+
+static int rate_calibrate_underruns = 0;
+module_param(rate_calibrate_underruns, int, 0444);
+MODULE_PARM_DESC(rate_calibrate_underruns, "Underruns per test window a samplerate may show and still pass calibration (default 0).");
+
 /*
  * ========================================================================================
  * PCM interface
  * ========================================================================================
  */
+static struct snd_pcm_hardware jornada720_pcm_hardware;
+
+/* Restrict the offered samplerates to limit, ALSA will resample in software above it. */
+static void jornada720_set_rate_limit(int limit) {
+	if (limit>48000) limit=48000;
+	if (limit<8000)  limit=8000;
+
+	DPRINTK(KERN_INFO "snd-jornada720: max. samplerate: %d\n", limit);
+
+	jornada720_pcm_hardware.rate_max = limit;
+	jornada720_pcm_hardware.rates = SNDRV_PCM_RATE_8000;
+	if (limit >= 11025) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_11025;
+	if (limit >= 16000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_16000;
+	if (limit >= 22050) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_22050;
+	if (limit >= 32000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_32000;
+	if (limit >= 44100) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_44100;
+	if (limit >= 48000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_48000;
+}
+
 static struct snd_pcm_hardware jornada720_pcm_hardware = {
 	.info =				(SNDRV_PCM_INFO_MMAP |
 				 		SNDRV_PCM_INFO_INTERLEAVED |				 		
@@ -225,6 +258,7 @@ static int jornada720_pcm_prepare(struct snd_pcm_substream *substream) {
 	playback_buffer.size = snd_pcm_lib_buffer_bytes(substream);
 	playback_buffer.period_size	= snd_pcm_lib_period_bytes(substream);
 	playback_buffer.loop = 1;
+	sa1111_dma_reset_stats(&playback_buffer);
 	// dbg_show_buffer(&playback_buffer);
 	// spin_unlock_irqrestore(&sachip->lock, flags);
 	return 0;
@@ -275,6 +309,12 @@ static int jornada720_pcm_open(struct snd_pcm_substream *substream) {
 	int err=0;
 	struct snd_jornada720 *jornada720 = snd_pcm_substream_chip(substream);
 	struct snd_pcm_runtime *runtime = substream->runtime;
+
+	// The samplerate calibration owns the DMA channel right now
+	if (!mutex_trylock(&jornada720->ratecal_mutex))
+		return -EBUSY;
+	mutex_unlock(&jornada720->ratecal_mutex);
+
 	// PCM Open code
 	runtime->hw = jornada720_pcm_hardware;
 	return 0;
@@ -755,6 +795,88 @@ static void jornada720_proc_init(struct snd_jornada720 *chip) {
 #define jornada720_proc_init(x)
 #endif /* CONFIG_SND_DEBUG && CONFIG_PROC_FS */
 
+/* Run the samplerate calibration and lower the offered rates to its result.
+ * Fails with -EBUSY if the PCM device is open. */
+static int jornada720_rate_calibrate(struct snd_jornada720 *jornada720) {
+	int rate;
+
+	mutex_lock(&jornada720->ratecal_mutex);
+	if (jornada720->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream_opened) {
+		mutex_unlock(&jornada720->ratecal_mutex);
+		return -EBUSY;
+	}
+
+	jornada720->ratecal.load_us = rate_calibrate_load;
+	jornada720->ratecal.max_underruns = rate_calibrate_underruns;
+	rate = jornada720_ratecal_run(jornada720->pdev_sa1111, &jornada720->ratecal);
+	if (rate > 0) {
+		jornada720_set_rate_limit(min(rate, rate_limit));
+		printk(KERN_INFO "sound: calibrated max. samplerate %d Hz, offering up to %d Hz\n", rate, jornada720_pcm_hardware.rate_max);
+	}
+	mutex_unlock(&jornada720->ratecal_mutex);
+	return rate < 0 ? rate : 0;
+}
+
+#ifdef CONFIG_PROC_FS
+/*
+ * proc interface for the samplerate calibration, write "run" to re-calibrate
+ */
+static void jornada720_ratecal_proc_read(struct snd_info_entry *entry, struct snd_info_buffer *buffer) {
+	struct snd_jornada720 *jornada720 = entry->private_data;
+	struct jornada720_ratecal *cal = &jornada720->ratecal;
+	struct jornada720_ratecal_result *res;
+	int i;
+
+	snd_iprintf(buffer, "rate_max %d\n", jornada720_pcm_hardware.rate_max);
+	snd_iprintf(buffer, "rate_limit %d\n", rate_limit);
+	snd_iprintf(buffer, "calibrated_rate %d\n", cal->rate);
+	snd_iprintf(buffer, "runs %d\n", cal->runs);
+	snd_iprintf(buffer, "load %d/%dus\n", cal->load_us, RATECAL_LOAD_PERIOD_US);
+	snd_iprintf(buffer, "underrun_threshold %d\n", cal->max_underruns);
+	snd_iprintf(buffer, "fifo_depth %d\n", SAC_FIFO_DEPTH);
+	snd_iprintf(buffer, "period_bytes %d\n", RATECAL_PERIOD_SIZE);
+
+	if (cal->runs) {
+		snd_iprintf(buffer, "\n rate  periods underruns fifo_min margin_us late_max_us result\n");
+		for (i = 0; i < RATECAL_NUM_RATES; i++) {
+			res = &cal->results[i];
+			snd_iprintf(buffer, "%5d %8u %9u %8u %9d %11d %s\n",
+				res->rate, res->periods, res->underruns, res->fifo_min,
+				res->margin_us, res->late_max_us, res->passed ? "pass" : "fail");
+		}
+	}
+
+	snd_iprintf(buffer, "\nplayback_periods %u\n", playback_buffer.periods);
+	snd_iprintf(buffer, "playback_underruns %u\n", playback_buffer.underruns);
+	snd_iprintf(buffer, "playback_fifo_min %u\n", playback_buffer.fifo_min);
+}
+
+static void jornada720_ratecal_proc_write(struct snd_info_entry *entry, struct snd_info_buffer *buffer) {
+	struct snd_jornada720 *jornada720 = entry->private_data;
+	char line[16];
+
+	while (!snd_info_get_line(buffer, line, sizeof(line))) {
+		if (strcmp(line, "run"))
+			continue;
+		if (jornada720_rate_calibrate(jornada720) < 0)
+			printk(KERN_ERR "sound: samplerate calibration failed (device busy?)\n");
+	}
+}
+
+static void jornada720_ratecal_proc_init(struct snd_jornada720 *chip) {
+	struct snd_info_entry *entry;
+
+	if (!snd_card_proc_new(chip->card, "rate_calibration", &entry)) {
+		snd_info_set_text_ops(entry, chip, jornada720_ratecal_proc_read);
+		entry->c.text.write = jornada720_ratecal_proc_write;
+		entry->mode |= S_IWUSR;
+		entry->private_data = chip;
+	}
+}
+#else
+#define jornada720_ratecal_proc_init(x)
+#endif /* CONFIG_PROC_FS */
+
 // Test hardware setup by playing a sound from hardcoded WAV file
 #ifdef STARTUP_CHIME
 static void sa1111_play_chime(struct sa1111_dev *devptr) {
@@ -861,6 +983,7 @@ static int snd_jornada720_probe(struct sa1111_dev *devptr) {
 	jornada720->card = card;
 	jornada720->pchip_uda1344 = uda1344_instance();
 	jornada720->pdev_sa1111 = devptr;
+	mutex_init(&jornada720->ratecal_mutex);
 
 	err = snd_card_jornada720_pcm(jornada720, idx, PCM_SUBSTREAMS);
 	if (err < 0)
@@ -877,6 +1000,7 @@ static int snd_jornada720_probe(struct sa1111_dev *devptr) {
 	sprintf(card->longname, "Jornada 720 %i", dev + 1);
 
 	jornada720_proc_init(jornada720);
+	jornada720_ratecal_proc_init(jornada720);
 	// Setup buffers
 	playback_buffer.snd_jornada720 = jornada720;
 	recording_buffer.snd_jornada720 = jornada720;
@@ -888,6 +1012,12 @@ static int snd_jornada720_probe(struct sa1111_dev *devptr) {
 		goto __nodev;
 	}
 
+	// Find out what this unit can play without underruns, before anyone can open the device
+	if (rate_calibrate) {
+		err = jornada720_rate_calibrate(jornada720);
+		if (err<0) printk(KERN_ERR "sound: samplerate calibration failed, using rate_limit %d.\n", rate_limit);
+	}
+
 	err = snd_card_register(card);
 	if (err == 0) {
 		sa1111_set_drvdata(devptr, card);
@@ -976,16 +1106,7 @@ static int __init alsa_card_jornada720_init(void)
 	if (rate_limit>48000) rate_limit=48000;
 	if (rate_limit<8000)  rate_limit=8000;
 
-	DPRINTK(KERN_INFO "snd-jornada720: max. samplerate: %d\n", rate_limit);
-
-	jornada720_pcm_hardware.rate_max = rate_limit;
-	jornada720_pcm_hardware.rates = SNDRV_PCM_RATE_8000;
-	if (rate_limit >= 11025) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_11025;
-	if (rate_limit >= 16000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_16000;
-	if (rate_limit >= 22050) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_22050;
-	if (rate_limit >= 32000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_32000;
-	if (rate_limit >= 44100) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_44100;
-	if (rate_limit >= 48000) jornada720_pcm_hardware.rates |= SNDRV_PCM_RATE_48000;
+	jornada720_set_rate_limit(rate_limit);
 
 	int err;
 	err = sa1111_driver_register(&snd_jornada720_driver);
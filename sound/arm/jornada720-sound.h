@@ -51,6 +51,9 @@ struct snd_jornada720 {
 	struct sa1111_dev * pdev_sa1111;
 	// The PCM substream we're playing
 	struct snd_pcm_substream *substream;
+	// Samplerate calibration, held while the calibration owns the DMA channel
+	struct mutex ratecal_mutex;
+	struct jornada720_ratecal ratecal;
 };
 
 #endif
\ No newline at end of file
@@ -1,3 +1 @@
-sudo ./cleartsmod.sh
-python j720_calibrate.py
-sudo ./loadtsmod.sh
+sudo python j720_calibrate.py
@@ -1,9 +1,54 @@
 #!/usr/bin/python
+# Jornada 720 touchscreen calibration
+# Shows 5 crosshairs on the framebuffer, reads the raw touch coordinates and
+# fits an affine matrix (tslib pointercal format) by least squares.
+# The matrix is written to the driver through sysfs, no module reload needed.
 import struct
 import time
 import sys
 
 infile_path = "/dev/input/event1"
+fb_path = "/dev/fb0"
+fb_sysfs = "/sys/class/graphics/fb0/"
+cal_path = "/sys/bus/platform/devices/jornada_ts/calibration"
+relative_path = "/sys/module/jornada720_ts/parameters/relative"
+
+# fixed point divisor of the matrix
+SCALE = 65536
+
+def read_sysfs(name):
+	f = open(fb_sysfs + name, "r")
+	value = f.read().strip()
+	f.close()
+	return value
+
+class Framebuffer:
+	def __init__(self):
+		(self.width, self.height) = [int(v) for v in read_sysfs("virtual_size").split(",")]
+		self.bpp = int(read_sysfs("bits_per_pixel"))
+		self.stride = int(read_sysfs("stride"))
+		self.bytespp = max(self.bpp // 8, 1)
+		self.fb = open(fb_path, "r+b")
+
+	def clear(self):
+		self.fb.seek(0)
+		self.fb.write(b"\x00" * (self.stride * self.height))
+		self.fb.flush()
+
+	def pixel(self, x, y):
+		if x < 0 or y < 0 or x >= self.width or y >= self.height:
+			return
+		self.fb.seek(y * self.stride + x * self.bytespp)
+		self.fb.write(b"\xff" * self.bytespp)
+
+	def crosshair(self, x, y, size=10):
+		for i in range(-size, size + 1):
+			self.pixel(x + i, y)
+			self.pixel(x, y + i)
+		self.fb.flush()
+
+	def close(self):
+		self.fb.close()
 
 def read_coords(dev):
 	FORMAT = 'llHHI'
@@ -11,65 +56,147 @@ def read_coords(dev):
 	event = dev.read(EVENT_SIZE)
 	x = 0
 	y = 0
-	sample_count = 0
+	samples = []
 	touched = True
 
 	while event and touched:
 		(sec, usec, type, code, value) = struct.unpack(FORMAT, event)
 		if type == 3: # coordinates
-			sample_count += 1
 			if code == 0:
 				x = value
 			if code == 1:
 				y = value
-			print ("X %u Y %u" % (x, y))
+		if type == 0 and x and y: # sync, one complete sample
+			samples.append((x, y))
 		if type == 1: # pen up / down
 			if code == 330 and value == 0:
-				print("Release")
-				if sample_count > 50:
+				if len(samples) > 20:
 					touched = False
 				else:
 					print("Again please...")
-			if code == 330 and value == 1:
-				print("Touch")
+					samples = []
 
 		event = dev.read(EVENT_SIZE)
 	# end of while
-	return x,y
+
+	# drop the samples from landing and lifting the pen, average the rest
+	samples = samples[len(samples) // 4 : len(samples) - len(samples) // 4]
+	x = float(sum([s[0] for s in samples])) / len(samples)
+	y = float(sum([s[1] for s in samples])) / len(samples)
+	return x, y
+
+def det3(m):
+	return (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+		- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+		+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]))
+
+# least squares fit of screen = a * rawx + b * rawy + c, solved with Cramer's rule
+def fit(raw, screen):
+	n = float(len(raw))
+	sx = sum([r[0] for r in raw])
+	sy = sum([r[1] for r in raw])
+	sxx = sum([r[0] * r[0] for r in raw])
+	syy = sum([r[1] * r[1] for r in raw])
+	sxy = sum([r[0] * r[1] for r in raw])
+	sxs = sum([raw[i][0] * screen[i] for i in range(len(raw))])
+	sys_ = sum([raw[i][1] * screen[i] for i in range(len(raw))])
+	ss = sum(screen)
+
+	m = [[sxx, sxy, sx], [sxy, syy, sy], [sx, sy, n]]
+	v = [sxs, sys_, ss]
+	d = det3(m)
+	if d == 0:
+		raise ValueError("points are collinear, calibration impossible")
+
+	result = []
+	for col in range(3):
+		mc = [row[:] for row in m]
+		for row in range(3):
+			mc[row][col] = v[row]
+		result.append(det3(mc) / d)
+	return result
+
+def read_calibration():
+	f = open(cal_path, "r")
+	value = f.read().strip()
+	f.close()
+	return value
+
+def write_calibration(value):
+	f = open(cal_path, "w")
+	f.write(value + "\n")
+	f.close()
 
 def main():
 	print("Jornada 720 screen calibration tool")
-	print("Touch (and keep touching) the upper right corner of the screen")
-	raw_input("Press Enter when ready...")
-	in_file = open(infile_path, "rb")
-	ur = read_coords(in_file)
 
-	print("Touch (and keep touching) the lower left corner of the screen")
-	raw_input("Press Enter when ready...")
-	ll = read_coords(in_file)
-	in_file.close()
+	# a relative (mouse) device can't report the raw coordinates, the driver refuses "none"
+	f = open(relative_path, "r")
+	relative = int(f.read().strip())
+	f.close()
+	if relative:
+		print("The driver runs in relative mode, reload it with relative=0 to calibrate.")
+		sys.exit(1)
 
-	print ur
-	print ll
+	# raw coordinates from the driver while calibrating
+	previous = read_calibration()
+	write_calibration("none")
+	a = None
+	try:
+		a = calibrate()
+	finally:
+		# Ctrl-C or a failed fit, the old matrix comes back
+		if a is None:
+			print("Calibration aborted, restoring %s" % previous)
+			write_calibration(previous)
 
-	# Calculate calibration data
-	(ur_x, ur_y) = ur
-	(ll_x, ll_y) = ll
+	matrix = " ".join([str(c) for c in a])
+	print("Calibration matrix: %s" % matrix)
+	write_calibration(matrix)
 
-	mx = 640.0 / (ur_x - ll_x)
-	my = 240.0 / (ll_y - ur_y)
+	# tslib compatible pointercal file and a modprobe call for system startup
+	f = open("pointercal", "w")
+	f.write(matrix + "\n")
+	f.close()
 
-	dx = min(ur_x, ll_x) * mx * -1.0
-	dy = min(ur_y, ll_y) * my * -1.0
+	f = open("loadtsmod.sh", "w")
+	f.write("rmmod jornada720_ts\n")
+	f.write("modprobe jornada720_ts matrix=%s\n" % ",".join([str(c) for c in a]))
+	f.close()
 
-	print("Calibration values mx=%f dx=%u, my=%f dy=%u" % (mx, dx, my, dy));
-	print("module parameters: mx=%u dx=%u, my=%u dy=%u" % (mx*1024, dx, my*1024, dy));
+# shows the crosshairs and returns the fitted matrix
+def calibrate():
+	fb = Framebuffer()
+	w = fb.width
+	h = fb.height
+	margin = 30
+	points = [(margin, margin), (w - margin, margin), (w - margin, h - margin), (margin, h - margin), (w // 2, h // 2)]
 
-	# write a file with the modprobe call
-	f = open("loadtsmod.sh","w")
-	f.write("rmmod jornada720_ts\n")
-	f.write("modprobe jornada720_ts mx=%u dx=%u my=%u dy=%u\n" % (mx*1024, dx, my*1024, dy));
-	f.close();
+	in_file = open(infile_path, "rb")
+	raw = []
+	for (px, py) in points:
+		fb.clear()
+		fb.crosshair(px, py)
+		print("Touch (and keep touching) the crosshair at %d,%d" % (px, py))
+		raw.append(read_coords(in_file))
+		print("raw X %.1f Y %.1f" % raw[-1])
+		time.sleep(0.5)
+	in_file.close()
+	fb.clear()
+	fb.close()
+
+	(a0, a1, a2) = fit(raw, [p[0] for p in points])
+	(a3, a4, a5) = fit(raw, [p[1] for p in points])
+	a = [int(round(c * SCALE)) for c in (a0, a1, a2, a3, a4, a5)] + [SCALE]
+
+	# report the residual error per point
+	for i in range(len(points)):
+		(rx, ry) = raw[i]
+		sx = (a[2] + a[0] * rx + a[1] * ry) / a[6]
+		sy = (a[5] + a[3] * rx + a[4] * ry) / a[6]
+		print("point %d: target %d,%d got %.1f,%.1f" % (i, points[i][0], points[i][1], sx, sy))
+
+	return a
 
 # Main program entry point.
 if __name__ == "__main__":
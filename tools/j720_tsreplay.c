@@ -0,0 +1,318 @@
+/*
+ * tools/j720_tsreplay.c
+ *
+ * Copyright (C) 2022 Timo Biesenbach <timo.biesenbach@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Replay a raw touchscreen capture (/sys/kernel/debug/jornada720_ts/raw)
+ * through the filter, calibration and softkey code of the jornada720_ts
+ * driver and score the result:
+ *
+ *  jitter  - RMS movement of the output while the pen rests
+ *  lag     - distance of the output behind the pen while it moves
+ *  dropped - samples that never made it to userspace
+ *
+ * The reference pen position is a centered (non causal) moving average of
+ * the calibrated raw samples, so it has no lag of its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "jornada720_ts.h"
+
+#define TRUTH_WINDOW	3		// samples on each side for the reference position
+#define REST_SPEED		20.0	// pixel/s below which the pen counts as resting
+#define MAX_STROKE		100000
+
+struct sample {
+	u64 time_ns;
+	int raw_x, raw_y;		// calibrated, unfiltered
+	double truth_x, truth_y;
+	double speed;			// of the reference position, pixel/s
+};
+
+struct stats {
+	unsigned long records, samples, invalid, overflows, strokes;
+	unsigned long first_dropped, suppressed, flushed, emitted;
+	unsigned long softkeys[5];
+	double pendown_s;
+	double rest_sq, raw_rest_sq;
+	unsigned long rest_n;
+	double lag_px, lag_ms;
+	unsigned long lag_n;
+	double release_ms;
+	unsigned long release_n;
+};
+
+static struct jornada_ts_params params = {
+	.median = 1,
+	.euro_mincutoff = 100,
+	.euro_beta = 10,
+};
+
+// default: the uncalibrated raw range (270..3900, 180..3700) mapped onto the screen
+static int matrix[7] = { 11554, 0, -3119580, 0, 4468, -804240, 65536 };
+
+static int verbose = 0;
+
+static struct sample stroke[MAX_STROKE];
+static int stroke_len;
+static u64 stroke_start, last_valid_ns;
+static int pendown;
+static int softkey_last;
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [options] capture.bin\n"
+		"  -m a0,a1,a2,a3,a4,a5,a6  calibration matrix (tslib pointercal order)\n"
+		"  -M 0|1   median of the 3 raw samples (default 1)\n"
+		"  -f n     box filter length (0 off)\n"
+		"  -i n     IIR shift (0 off)\n"
+		"  -e       1-euro filter on\n"
+		"  -c n     1-euro mincutoff in 1/100 Hz (default 100)\n"
+		"  -b n     1-euro beta in 1/1000 (default 10)\n"
+		"  -p n     predict n msec ahead (0 off)\n"
+		"  -r n     max. reports per second (0 off)\n"
+		"  -d n     dead-band in pixels (0 off)\n"
+		"  -v       print every sample as CSV\n", name);
+	exit(1);
+}
+
+// Compute the reference position and speed for the buffered stroke
+static void stroke_truth(void)
+{
+	int i, j, lo, hi;
+	double sx, sy, dt;
+
+	for (i=0; i<stroke_len; i++) {
+		lo = i - TRUTH_WINDOW < 0 ? 0 : i - TRUTH_WINDOW;
+		hi = i + TRUTH_WINDOW >= stroke_len ? stroke_len - 1 : i + TRUTH_WINDOW;
+		sx = sy = 0;
+		for (j=lo; j<=hi; j++) {
+			sx += stroke[j].raw_x;
+			sy += stroke[j].raw_y;
+		}
+		stroke[i].truth_x = sx / (hi - lo + 1);
+		stroke[i].truth_y = sy / (hi - lo + 1);
+	}
+
+	// speed over the whole window, a neighbour difference would mostly measure noise
+	for (i=0; i<stroke_len; i++) {
+		lo = i - TRUTH_WINDOW < 0 ? 0 : i - TRUTH_WINDOW;
+		hi = i + TRUTH_WINDOW >= stroke_len ? stroke_len - 1 : i + TRUTH_WINDOW;
+		dt = (stroke[hi].time_ns - stroke[lo].time_ns) / 1e9;
+		stroke[i].speed = (dt > 0) ? hypot(stroke[hi].truth_x - stroke[lo].truth_x, stroke[hi].truth_y - stroke[lo].truth_y) / dt : 0;
+	}
+}
+
+static void score(struct stats *st, const struct sample *s, int out_x, int out_y, int prev_x, int prev_y, const struct sample *prev)
+{
+	double err = hypot(out_x - s->truth_x, out_y - s->truth_y);
+
+	if (s->speed < REST_SPEED) {
+		if (prev) {
+			st->rest_sq += (double)(out_x - prev_x) * (out_x - prev_x) + (double)(out_y - prev_y) * (out_y - prev_y);
+			st->raw_rest_sq += (double)(s->raw_x - prev->raw_x) * (s->raw_x - prev->raw_x) +
+					   (double)(s->raw_y - prev->raw_y) * (s->raw_y - prev->raw_y);
+			st->rest_n++;
+		}
+	} else {
+		st->lag_px += err;
+		st->lag_ms += err / s->speed * 1000.0;
+		st->lag_n++;
+	}
+}
+
+// Run the driver pipeline over the buffered stroke, same order as jornada720_ts_report()
+static void stroke_replay(struct stats *st)
+{
+	struct jornada_ts_filter f;
+	const struct sample *s, *last = NULL, *pending = NULL;
+	int x, y, pend_x = 0, pend_y = 0;
+	int last_x = 0, last_y = 0;
+	u64 last_report = 0, prev_ns = 0;
+	u32 dt_us;
+	int i;
+
+	if (!stroke_len) return;
+	stroke_truth();
+	jornada720_ts_filter_init(&f);
+
+	for (i=0; i<stroke_len; i++) {
+		s = &stroke[i];
+		x = s->raw_x;
+		y = s->raw_y;
+
+		dt_us = prev_ns ? (u32)((s->time_ns - prev_ns) / 1000) : 0;
+		prev_ns = s->time_ns;
+		jornada720_ts_filter_apply(&f, &params, &x, &y, dt_us);
+
+		if (last && jornada720_ts_suppress_check(&params, (s64)(s->time_ns - last_report) / 1000, x - last_x, y - last_y)) {
+			st->suppressed++;
+			pending = s;
+			pend_x = x;
+			pend_y = y;
+			if (verbose) printf("%.3f,%d,%d,%d,%d,0\n", s->time_ns / 1e6, s->raw_x, s->raw_y, x, y);
+			continue;
+		}
+
+		score(st, s, x, y, last_x, last_y, last);
+		if (verbose) printf("%.3f,%d,%d,%d,%d,1\n", s->time_ns / 1e6, s->raw_x, s->raw_y, x, y);
+		st->emitted++;
+		last = s;
+		last_x = x;
+		last_y = y;
+		last_report = s->time_ns;
+		pending = NULL;
+	}
+
+	// the driver sends a suppressed last position on pen-up, without prediction
+	if (last && jornada720_ts_filter_actual(&f, &params, &pend_x, &pend_y))
+		pending = s;
+	if (pending) {
+		score(st, pending, pend_x, pend_y, last_x, last_y, last);
+		st->flushed++;
+		st->emitted++;
+	}
+}
+
+static void pen_up(struct stats *st, u64 time_ns)
+{
+	if (!pendown) return;
+
+	stroke_replay(st);
+	st->strokes++;
+	st->pendown_s += (time_ns - stroke_start) / 1e9;
+	if (last_valid_ns) {
+		st->release_ms += (time_ns - last_valid_ns) / 1e6;
+		st->release_n++;
+	}
+
+	stroke_len = 0;
+	pendown = 0;
+	softkey_last = 0;
+}
+
+static void sample(struct stats *st, const struct jornada_ts_record *rec)
+{
+	int x_data[4], y_data[4];
+	int x, y, key;
+
+	st->samples++;
+	jornada720_ts_unpack(rec->data, x_data, y_data);
+	x = jornada720_ts_average(x_data, params.median);
+	y = jornada720_ts_average(y_data, params.median);
+	jornada720_ts_calibrate(matrix, &x, &y);
+	last_valid_ns = rec->time_ns;
+
+	// the driver drops the first sample after pen-down
+	if (!pendown) {
+		pendown = 1;
+		stroke_start = rec->time_ns;
+		st->first_dropped++;
+		return;
+	}
+
+	if (x > MAXX) {
+		key = jornada720_ts_softkey(y);
+		if (key != softkey_last) st->softkeys[key]++;
+		softkey_last = key;
+		return;
+	}
+
+	if (stroke_len < MAX_STROKE) {
+		stroke[stroke_len].time_ns = rec->time_ns;
+		stroke[stroke_len].raw_x = x;
+		stroke[stroke_len].raw_y = y;
+		stroke_len++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct jornada_ts_record rec;
+	struct stats st;
+	u64 first_ns = 0, last_ns = 0;
+	FILE *in;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:M:f:i:ec:b:p:r:d:v")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (sscanf(optarg, "%d,%d,%d,%d,%d,%d,%d", &matrix[0], &matrix[1], &matrix[2],
+				   &matrix[3], &matrix[4], &matrix[5], &matrix[6]) != 7 || !matrix[6])
+				usage(argv[0]);
+			break;
+		case 'M': params.median = atoi(optarg); break;
+		case 'f': params.filter = atoi(optarg); break;
+		case 'i': params.iir = atoi(optarg); break;
+		case 'e': params.euro = 1; break;
+		case 'c': params.euro_mincutoff = atoi(optarg); break;
+		case 'b': params.euro_beta = atoi(optarg); break;
+		case 'p': params.predict = atoi(optarg); break;
+		case 'r': params.max_rate = atoi(optarg); break;
+		case 'd': params.deadband = atoi(optarg); break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1) usage(argv[0]);
+
+	// same limits as the driver
+	jornada720_ts_params_clamp(&params);
+
+	in = fopen(argv[optind], "rb");
+	if (!in) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	if (verbose) printf("time_ms,raw_x,raw_y,out_x,out_y,reported\n");
+
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		st.records++;
+		if (!first_ns) first_ns = rec.time_ns;
+		last_ns = rec.time_ns;
+
+		if (rec.flags & JORNADA_TS_REC_OVERFLOW) st.overflows++;
+
+		if (rec.flags & JORNADA_TS_REC_PENUP)
+			pen_up(&st, rec.time_ns);
+		else if (rec.flags & JORNADA_TS_REC_VALID)
+			sample(&st, &rec);
+		else
+			st.invalid++;
+	}
+	fclose(in);
+	pen_up(&st, last_ns);
+
+	printf("filter: median %d box %d iir %d euro %d (mincutoff %d beta %d) predict %d max_rate %d deadband %d\n",
+	       params.median, params.filter, params.iir, params.euro, params.euro_mincutoff, params.euro_beta,
+	       params.predict, params.max_rate, params.deadband);
+	printf("records %lu, %.1f s, %lu strokes, %.1f s pen down\n",
+	       st.records, (last_ns - first_ns) / 1e9, st.strokes, st.pendown_s);
+	printf("samples %lu, invalid %lu, capture overflows %lu\n", st.samples, st.invalid, st.overflows);
+	printf("reported %lu (%.1f/s pen down), dropped: first after pen-down %lu, suppressed %lu (%lu flushed on pen-up)\n",
+	       st.emitted, st.pendown_s > 0 ? st.emitted / st.pendown_s : 0.0,
+	       st.first_dropped, st.suppressed, st.flushed);
+	printf("softkeys: settings %lu, pccard %lu, phone %lu, media %lu\n",
+	       st.softkeys[JORNADA_TS_KEY_SETTINGS], st.softkeys[JORNADA_TS_KEY_PCCARD],
+	       st.softkeys[JORNADA_TS_KEY_PHONE], st.softkeys[JORNADA_TS_KEY_MEDIA]);
+	if (st.rest_n)
+		printf("jitter at rest: %.2f px RMS (raw %.2f px) over %lu samples\n",
+		       sqrt(st.rest_sq / st.rest_n), sqrt(st.raw_rest_sq / st.rest_n), st.rest_n);
+	if (st.lag_n)
+		printf("lag while moving: %.2f px, %.1f ms over %lu samples\n",
+		       st.lag_px / st.lag_n, st.lag_ms / st.lag_n, st.lag_n);
+	if (st.release_n)
+		printf("pen-up detection: %.1f ms after the last sample\n", st.release_ms / st.release_n);
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * tools/s1dblt.c
+ *
+ * Copyright (C) 2022 Timo Biesenbach <timo.biesenbach@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Batching of BitBLT operations for the s1d13xxxfb driver, see s1dblt.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "s1dblt.h"
+
+int s1dblt_open(struct s1dblt *blt, int fd)
+{
+	struct s1dfb_blt_batch batch;
+
+	memset(blt, 0, sizeof(*blt));
+	blt->fd = fd;
+	blt->key = -1;
+
+	// an empty batch tells whether the driver can do it
+	memset(&batch, 0, sizeof(batch));
+	return ioctl(fd, S1DFB_IOC_BLIT, &batch);
+}
+
+void s1dblt_rop(struct s1dblt *blt, unsigned int rop)
+{
+	blt->rop = rop;
+}
+
+void s1dblt_key(struct s1dblt *blt, int key)
+{
+	blt->key = key;
+}
+
+static struct s1dfb_blt_op *s1dblt_next(struct s1dblt *blt, unsigned int type)
+{
+	struct s1dfb_blt_op *op;
+
+	if (blt->count == S1DFB_BLT_MAX_OPS && s1dblt_flush(blt, 0) < 0)
+		return NULL;
+
+	op = &blt->ops[blt->count++];
+	memset(op, 0, sizeof(*op));
+	op->op = type;
+
+	// expand has no ROP, fill no transparency
+	if (type != S1DFB_BLT_EXPAND)
+		op->rop = blt->rop;
+	if (type != S1DFB_BLT_FILL && blt->key >= 0) {
+		op->flags = S1DFB_BLT_TRANSPARENT;
+		op->bg = blt->key;
+	}
+	return op;
+}
+
+int s1dblt_fill(struct s1dblt *blt, int x, int y, int w, int h, unsigned int color)
+{
+	struct s1dfb_blt_op *op = s1dblt_next(blt, S1DFB_BLT_FILL);
+
+	if (!op)
+		return -1;
+	op->dx = x;
+	op->dy = y;
+	op->width = w;
+	op->height = h;
+	op->fg = color;
+	return 0;
+}
+
+int s1dblt_copy(struct s1dblt *blt, int sx, int sy, int dx, int dy, int w, int h)
+{
+	struct s1dfb_blt_op *op = s1dblt_next(blt, S1DFB_BLT_COPY);
+
+	if (!op)
+		return -1;
+	op->sx = sx;
+	op->sy = sy;
+	op->dx = dx;
+	op->dy = dy;
+	op->width = w;
+	op->height = h;
+	return 0;
+}
+
+int s1dblt_write(struct s1dblt *blt, int x, int y, int w, int h, const void *data, int pitch)
+{
+	struct s1dfb_blt_op *op = s1dblt_next(blt, S1DFB_BLT_WRITE);
+
+	if (!op)
+		return -1;
+	op->dx = x;
+	op->dy = y;
+	op->width = w;
+	op->height = h;
+	op->pitch = pitch;
+	op->data = (uintptr_t)data;
+	return 0;
+}
+
+int s1dblt_expand(struct s1dblt *blt, int x, int y, int w, int h, const void *bits, int pitch,
+		unsigned int fg, unsigned int bg)
+{
+	struct s1dfb_blt_op *op = s1dblt_next(blt, S1DFB_BLT_EXPAND);
+
+	if (!op)
+		return -1;
+	op->dx = x;
+	op->dy = y;
+	op->width = w;
+	op->height = h;
+	op->pitch = pitch;
+	op->fg = fg;
+	if (!op->flags)
+		op->bg = bg;
+	op->data = (uintptr_t)bits;
+	return 0;
+}
+
+int s1dblt_pattern(struct s1dblt *blt, int x, int y, int w, int h, const void *pattern)
+{
+	struct s1dfb_blt_op *op = s1dblt_next(blt, S1DFB_BLT_PATTERN);
+
+	if (!op)
+		return -1;
+	op->dx = x;
+	op->dy = y;
+	op->width = w;
+	op->height = h;
+	op->data = (uintptr_t)pattern;
+	return 0;
+}
+
+int s1dblt_flush(struct s1dblt *blt, int sync)
+{
+	struct s1dfb_blt_batch batch;
+	int ret;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.ops = (uintptr_t)blt->ops;
+	batch.count = blt->count;
+	batch.flags = sync ? S1DFB_BLT_BATCH_SYNC : 0;
+
+	ret = ioctl(blt->fd, S1DFB_IOC_BLIT, &batch);
+	if (ret < 0)
+		fprintf(stderr, "s1dblt: operation %u of %u failed: %s\n",
+			batch.done, blt->count, strerror(errno));
+	blt->count = 0;
+	return ret;
+}
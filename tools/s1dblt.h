@@ -0,0 +1,47 @@
+/*
+ * tools/s1dblt.h
+ *
+ * Copyright (C) 2022 Timo Biesenbach <timo.biesenbach@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Small userspace library for the S1DFB_IOC_BLIT ioctl of the s1d13xxxfb
+ * driver. Operations are queued and sent to the driver in batches, either
+ * when the queue is full or on s1dblt_flush(). Buffers passed to
+ * s1dblt_write() and s1dblt_expand() have to stay valid until then.
+ */
+#ifndef S1DBLT_H
+#define S1DBLT_H
+
+#include <video/s1d13xxxfb.h>
+
+struct s1dblt {
+	int fd;
+	unsigned int count;
+	unsigned int rop;		// S1DFB_ROP_xxx for the following operations
+	int key;			// color key, -1 = none
+	struct s1dfb_blt_op ops[S1DFB_BLT_MAX_OPS];
+};
+
+int s1dblt_open(struct s1dblt *blt, int fd);
+
+// raster operation of the following fills, copies, writes and patterns (0 = copy)
+void s1dblt_rop(struct s1dblt *blt, unsigned int rop);
+// color key of the following copies, writes and patterns, -1 switches it off;
+// expands skip the clear bits while a key is set
+void s1dblt_key(struct s1dblt *blt, int key);
+
+int s1dblt_fill(struct s1dblt *blt, int x, int y, int w, int h, unsigned int color);
+int s1dblt_copy(struct s1dblt *blt, int sx, int sy, int dx, int dy, int w, int h);
+int s1dblt_write(struct s1dblt *blt, int x, int y, int w, int h, const void *data, int pitch);
+int s1dblt_expand(struct s1dblt *blt, int x, int y, int w, int h, const void *bits, int pitch,
+		unsigned int fg, unsigned int bg);
+// 8x8 pattern in screen depth (16x8 in 4bpp), anchored to the screen
+int s1dblt_pattern(struct s1dblt *blt, int x, int y, int w, int h, const void *pattern);
+
+// sends the queue, sync != 0 waits for the engine (before touching the mmap'ed screen)
+int s1dblt_flush(struct s1dblt *blt, int sync);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * tools/s1dblt_demo.c
+ *
+ * Copyright (C) 2022 Timo Biesenbach <timo.biesenbach@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Example for s1dblt: clears the screen, draws a checkerboard with
+ * fills, a sprite with a write blit, a line of text with color expand, a
+ * hatched band with a pattern, inverts a box with an XOR fill and scrolls
+ * the whole thing up with screen to screen copies. Run it on the
+ * Jornada with the console switched away (or blanked) from /dev/fb0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+
+#include "s1dblt.h"
+
+#define SPRITE		32
+
+// 8x8 "J720", MSB is the leftmost pixel
+static const unsigned char text[8][4] = {
+	{ 0x1e, 0x7e, 0x3c, 0x3c },
+	{ 0x0c, 0x06, 0x66, 0x66 },
+	{ 0x0c, 0x0c, 0x06, 0x6e },
+	{ 0x0c, 0x18, 0x0c, 0x76 },
+	{ 0x0c, 0x18, 0x30, 0x66 },
+	{ 0x6c, 0x18, 0x60, 0x66 },
+	{ 0x38, 0x18, 0x7e, 0x3c },
+	{ 0x00, 0x00, 0x00, 0x00 },
+};
+
+// palette index or RGB565, whatever the screen is in
+static unsigned int color(const struct fb_var_screeninfo *var, int r, int g, int b)
+{
+	if (var->bits_per_pixel == 16)
+		return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	return ((r + g + b) / 3) >> (8 - var->bits_per_pixel);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = argc > 1 ? argv[1] : "/dev/fb0";
+	struct fb_var_screeninfo var;
+	struct s1dblt blt;
+	unsigned short sprite[SPRITE * SPRITE];
+	unsigned char sprite8[SPRITE * SPRITE];
+	unsigned short hatch[64];
+	unsigned char hatch8[64];
+	int fd, x, y, i;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0 || ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (s1dblt_open(&blt, fd) < 0) {
+		perror("S1DFB_IOC_BLIT");
+		return 1;
+	}
+
+	// checkerboard
+	s1dblt_fill(&blt, 0, 0, var.xres, var.yres, color(&var, 0, 0, 0));
+	for (y = 0; y < var.yres; y += 16)
+		for (x = (y / 16) & 1 ? 16 : 0; x < var.xres; x += 32)
+			s1dblt_fill(&blt, x, y, 16, 16, color(&var, 64, 64, 128));
+
+	// a shaded square, queued as is: the data stays valid until the flush below
+	for (y = 0; y < SPRITE; y++)
+		for (x = 0; x < SPRITE; x++) {
+			sprite[y * SPRITE + x] = color(&var, x * 8, y * 8, 255 - x * 4);
+			sprite8[y * SPRITE + x] = color(&var, x * 8, y * 8, 255 - x * 4);
+		}
+	for (i = 0; i < 8; i++) {
+		if (var.bits_per_pixel == 16)
+			s1dblt_write(&blt, 40 + i * 48, 40, SPRITE, SPRITE, sprite, SPRITE * 2);
+		else if (var.bits_per_pixel == 8)
+			s1dblt_write(&blt, 40 + i * 48, 40, SPRITE, SPRITE, sprite8, SPRITE);
+	}
+
+	s1dblt_expand(&blt, 40, 100, 32, 8, text, 4, color(&var, 255, 255, 255), color(&var, 0, 0, 0));
+	if (s1dblt_flush(&blt, 0) < 0)
+		return 1;
+
+	// diagonal hatch, needs offscreen VRAM; the failure is reported by the flush
+	for (i = 0; i < 64; i++) {
+		hatch[i] = ((i >> 3) + (i & 7)) & 4 ? color(&var, 255, 200, 0) : color(&var, 0, 0, 0);
+		hatch8[i] = hatch[i];
+	}
+	if (var.bits_per_pixel == 16)
+		s1dblt_pattern(&blt, 0, 140, var.xres, 24, hatch);
+	else if (var.bits_per_pixel == 8)
+		s1dblt_pattern(&blt, 0, 140, var.xres, 24, hatch8);
+
+	s1dblt_rop(&blt, S1DFB_ROP_XOR);
+	s1dblt_fill(&blt, 20, 30, 200, 100, color(&var, 255, 255, 255));
+	s1dblt_rop(&blt, S1DFB_ROP_COPY);
+	s1dblt_flush(&blt, 0);
+
+	// scroll up 2 lines at a time, one batch per step
+	for (i = 0; i < var.yres / 2; i++) {
+		s1dblt_copy(&blt, 0, 2, 0, 0, var.xres, var.yres - 2);
+		s1dblt_fill(&blt, 0, var.yres - 2, var.xres, 2, color(&var, 0, 0, 0));
+		if (s1dblt_flush(&blt, 1) < 0)
+			return 1;
+		usleep(10000);
+	}
+
+	close(fd);
+	return 0;
+}